@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "xorshift.hpp"
+
+namespace cuckoo {
+
+// A ring of recently looked up keys that a table's rebalance() ranks to find
+// its hottest keys. The ring is only allocated once sampling is enabled, so
+// tables that never sample carry three words instead of the ring.
+//
+// Each lookup is sampled with probability 1 / period, drawn from a per-thread
+// generator, so the rate of one table does not depend on lookups into others.
+// Each thread also writes the ring through its own cursor, starting at a
+// per-thread offset, so recording a sample is a relaxed store with no shared
+// read-modify-write. Threads whose cursors meet overwrite each other's
+// samples, which only thins the sample.
+class access_sampler {
+ public:
+  static constexpr size_t SAMPLE_SZ = 1024;
+  static_assert((SAMPLE_SZ & (SAMPLE_SZ - 1)) == 0);
+
+  // marks an unused entry, the tables' NULL_KEY
+  static constexpr uint64_t EMPTY = -1;
+
+  access_sampler() = default;
+
+  access_sampler(access_sampler&& other) noexcept
+      : period_(std::exchange(other.period_, 0)),
+        threshold_(std::exchange(other.threshold_, 0)),
+        samples_(std::move(other.samples_)) {}
+
+  access_sampler& operator=(access_sampler&& other) noexcept {
+    period_ = std::exchange(other.period_, 0);
+    threshold_ = std::exchange(other.threshold_, 0);
+    samples_ = std::move(other.samples_);
+    return *this;
+  }
+
+  // A sampler with the same period and no samples yet.
+  access_sampler clone() const {
+    access_sampler copy;
+    copy.set_period(period_);
+    return copy;
+  }
+
+  // Samples roughly one in `period` keys, 0 disables sampling and frees the
+  // ring. Must not race with record().
+  void set_period(size_t period) {
+    period_ = period;
+    if (!period) {
+      threshold_ = 0;
+      samples_.reset();
+      return;
+    }
+    threshold_ = std::numeric_limits<uint64_t>::max() / period;
+    if (!samples_) {
+      samples_ = std::make_unique<std::atomic<uint64_t>[]>(SAMPLE_SZ);
+      for (size_t i = 0; i < SAMPLE_SZ; ++i) {
+        samples_[i].store(EMPTY, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  size_t period() const { return period_; }
+  bool enabled() const { return period_ != 0; }
+
+  // Only call while enabled(). Safe to call from several threads at once.
+  void record(uint64_t key) {
+    thread_state& state = local_state();
+    if (state.rng() > threshold_) {
+      return;
+    }
+    samples_[state.cursor++ & (SAMPLE_SZ - 1)].store(
+        key, std::memory_order_relaxed);
+  }
+
+  // Consumes the samples and returns the distinct keys, most sampled first.
+  std::vector<uint64_t> take_hottest() {
+    std::vector<uint64_t> samples;
+    if (!samples_) {
+      return samples;
+    }
+    samples.reserve(SAMPLE_SZ);
+    for (size_t i = 0; i < SAMPLE_SZ; ++i) {
+      uint64_t key = samples_[i].exchange(EMPTY, std::memory_order_relaxed);
+      if (key != EMPTY) {
+        samples.push_back(key);
+      }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::vector<std::pair<size_t, uint64_t>> counts;
+    for (size_t i = 0; i < samples.size();) {
+      size_t j = i;
+      while (j < samples.size() && samples[j] == samples[i]) {
+        j++;
+      }
+      counts.emplace_back(j - i, samples[i]);
+      i = j;
+    }
+    std::stable_sort(
+        counts.begin(), counts.end(),
+        [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<uint64_t> keys;
+    keys.reserve(counts.size());
+    for (const auto& count : counts) {
+      keys.push_back(count.second);
+    }
+    return keys;
+  }
+
+ private:
+  struct thread_state {
+    xorshift64 rng;
+    size_t cursor;
+  };
+
+  static thread_state& local_state() {
+    static std::atomic<uint64_t> num_threads{0};
+    thread_local thread_state state = [] {
+      uint64_t seed = (num_threads.fetch_add(1, std::memory_order_relaxed) +
+                       1) * 0x9e3779b97f4a7c15;
+      return thread_state{xorshift64(seed), static_cast<size_t>(seed >> 54)};
+    }();
+    return state;
+  }
+
+  size_t period_{0};
+  uint64_t threshold_{0};
+  std::unique_ptr<std::atomic<uint64_t>[]> samples_;
+};
+
+}  // namespace cuckoo
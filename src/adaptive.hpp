@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "cuckoo_set.hpp"
+#include "cuckoo_table.hpp"
+
+namespace cuckoo {
+
+// Wraps a cuckoo_set or cuckoo_table and switches to a direct-indexed
+// representation when the keys form a dense range: a bitmap for sets, a
+// bitmap plus a value array for tables. It switches back to hashing when the
+// range becomes sparse again. The lookup API mirrors the wrapped container,
+// including the strided, gather and deref batches, except that iterators are
+// also invalidated by a representation switch.
+//
+// This is a wrapper rather than a mode of cuckoo_set and cuckoo_table
+// themselves. Their iterators point into buckets, which a bitmap does not
+// have, and front_cache, probe_many and the replicated and published tables
+// rely on that. A mode would also add a representation branch to every
+// lookup of every table, including the many that never turn dense. Opting in
+// is a type change instead, and the plain tables keep their lookup path.
+template <class Inner, bool WithValues>
+class adaptive_container {
+ public:
+  struct iterator {
+    bool is_null() const { return !found_; }
+    const KeyT& key() const { return key_; }
+    ValueT& value() requires WithValues { return *value_; }
+
+    KeyT key_{NULL_KEY};
+    ValueT* value_{nullptr};
+    typename Inner::iterator inner_{};
+    bool found_{false};
+  };
+
+  adaptive_container(size_t capacity) : capacity_(capacity) {
+    hashed_.emplace(capacity_);
+  }
+
+  size_t size() { return sz_; }
+  bool is_dense() { return !hashed_.has_value(); }
+
+  iterator find(KeyT key) {
+    if (hashed_) {
+      return wrap(hashed_->find(key));
+    }
+    return find_dense(key);
+  }
+
+  void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
+    find_batched_impl(
+        [keys](size_t i) { return keys[i]; },
+        [&](size_t begin, size_t n, typename Inner::iterator* out) {
+          hashed_->find_batched(keys + begin, n, out);
+        },
+        num_keys, results);
+  }
+
+  // As find_batched(), with the i-th key read from
+  // `base + i * stride + offset`.
+  void find_batched_strided(const void* base, size_t stride, size_t offset,
+                            size_t num_keys, iterator* results) {
+    const auto* bytes = static_cast<const uint8_t*>(base) + offset;
+    find_batched_impl(
+        [bytes, stride](size_t i) {
+          KeyT key;
+          std::memcpy(&key, bytes + i * stride, sizeof(KeyT));
+          return key;
+        },
+        [&](size_t begin, size_t n, typename Inner::iterator* out) {
+          hashed_->find_batched_strided(bytes + begin * stride, stride, 0, n,
+                                        out);
+        },
+        num_keys, results);
+  }
+
+  // As find_batched(), with the i-th key being `keys[idxs[i]]`.
+  void find_batched_gather(const KeyT* keys, const size_t* idxs,
+                           size_t num_keys, iterator* results) {
+    find_batched_impl(
+        [keys, idxs](size_t i) { return keys[idxs[i]]; },
+        [&](size_t begin, size_t n, typename Inner::iterator* out) {
+          hashed_->find_batched_gather(keys, idxs + begin, n, out);
+        },
+        num_keys, results);
+  }
+
+  // See cuckoo_table::find_batched_deref(). Dense lookups touch no bucket, so
+  // only the records of a batch's hits are prefetched before it is handed to
+  // `fn`.
+  template <class Fn>
+  void find_batched_deref(const KeyT* keys, size_t num_keys, Fn&& fn)
+    requires WithValues
+  {
+    if (hashed_) {
+      hashed_->find_batched_deref(
+          keys, num_keys, [&](size_t i, typename Inner::iterator it) {
+            fn(i, wrap(it));
+          });
+      return;
+    }
+
+    std::array<iterator, MAX_LOOKUP_BATCH_SZ> batch;
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(num_keys - base, MAX_LOOKUP_BATCH_SZ);
+      for (size_t i = 0; i < batch_sz; ++i) {
+        batch[i] = find_dense(keys[base + i]);
+        if (!batch[i].is_null()) {
+          __builtin_prefetch(
+              reinterpret_cast<const void*>(batch[i].value()), 0, 3);
+        }
+      }
+      for (size_t i = 0; i < batch_sz; ++i) {
+        fn(base + i, batch[i]);
+      }
+    }
+  }
+
+  void erase(const iterator& it) {
+    sz_--;
+    if (hashed_) {
+      hashed_->erase(it.inner_);
+      return;
+    }
+
+    uint64_t off = it.key_ - base_;
+    bits_[off / 64] &= ~(uint64_t{1} << (off % 64));
+    if (sz_ * SPARSE_RATIO < span()) {
+      try {
+        to_hashed();
+      } catch (const std::runtime_error&) {
+        // the keys did not all fit, the bitmap still holds them
+      }
+    }
+  }
+
+  void insert(KeyT key) requires (!WithValues) {
+    insert_impl(key, NULL_VALUE);
+  }
+  void insert(KeyT key, ValueT value) requires WithValues {
+    insert_impl(key, value);
+  }
+
+ private:
+  // A bitmap costs a bit per key in the range against roughly 10B per key for
+  // a hashed set, a value array 8B against roughly 20B for a hashed table.
+  // The gap between the two ratios keeps a table near the threshold from
+  // flipping back and forth.
+  static constexpr size_t DENSE_RATIO = WithValues ? 2 : 16;
+  static constexpr size_t SPARSE_RATIO = WithValues ? 4 : 64;
+  // below this many keys either representation is small
+  static constexpr size_t DENSE_MIN_KEYS = 1024;
+  // A hashed container fails inserts well before every slot is taken, so a
+  // dense one admits no more keys than switching back can re-insert.
+  static constexpr double MAX_HASHED_LOAD = 0.9;
+
+  // Looks up MAX_LOOKUP_BATCH_SZ keys at a time, through `inner_find(begin,
+  // n, out)` while hashed and `load_key(i)` while dense.
+  template <class KeyLoader, class InnerFind>
+  void find_batched_impl(KeyLoader load_key, InnerFind inner_find,
+                         size_t num_keys, iterator* results) {
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(num_keys - base, MAX_LOOKUP_BATCH_SZ);
+      if (hashed_) {
+        std::array<typename Inner::iterator, MAX_LOOKUP_BATCH_SZ> inner;
+        inner_find(base, batch_sz, inner.data());
+        for (size_t i = 0; i < batch_sz; ++i) {
+          results[base + i] = wrap(inner[i]);
+        }
+      } else {
+        for (size_t i = 0; i < batch_sz; ++i) {
+          results[base + i] = find_dense(load_key(base + i));
+        }
+      }
+    }
+  }
+
+  void insert_impl(KeyT key, ValueT value) {
+    if (key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+    if (hashed_) {
+      if constexpr (WithValues) {
+        hashed_->insert(key, value);
+      } else {
+        hashed_->insert(key);
+      }
+      sz_++;
+      lo_ = std::min(lo_, key);
+      hi_ = std::max(hi_, key);
+      if (sz_ >= DENSE_MIN_KEYS && hi_ - lo_ < sz_ * DENSE_RATIO) {
+        to_dense();
+      }
+      return;
+    }
+
+    if (!find_dense(key).is_null()) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+    bool in_range = key - base_ < span();
+    KeyT lo = std::min(base_, key);
+    KeyT hi = std::max(base_ + (span() - 1), key);
+    if (!in_range && hi - lo >= (sz_ + 1) * SPARSE_RATIO) {
+      to_hashed();
+      return insert_impl(key, value);
+    }
+    if (sz_ >= max_dense_keys()) {
+      throw std::runtime_error{"cannot find insertion slot."};
+    }
+
+    if (!in_range) {
+      // leave slack on the side that grew so that appends are amortized
+      uint64_t slack = span() / 2;
+      if (key < base_) {
+        lo = lo > slack ? lo - slack : 0;
+      } else {
+        hi = hi < NULL_KEY - 1 - slack ? hi + slack : NULL_KEY - 1;
+      }
+      rebuild_dense(lo, hi);
+    }
+
+    sz_++;
+    uint64_t off = key - base_;
+    bits_[off / 64] |= uint64_t{1} << (off % 64);
+    if constexpr (WithValues) {
+      values_[off] = value;
+    }
+  }
+
+  iterator find_dense(KeyT key) {
+    uint64_t off = key - base_;
+    if (off >= span() || !((bits_[off / 64] >> (off % 64)) & 1)) {
+      return {};
+    }
+    if constexpr (WithValues) {
+      return {key, &values_[off], {}, true};
+    } else {
+      return {key, nullptr, {}, true};
+    }
+  }
+
+  iterator wrap(typename Inner::iterator inner) {
+    if (inner.is_null()) {
+      return {};
+    }
+    if constexpr (WithValues) {
+      return {inner.key(), &inner.value(), inner, true};
+    } else {
+      return {inner.key(), nullptr, inner, true};
+    }
+  }
+
+  uint64_t span() const { return bits_.size() * 64; }
+
+  size_t max_dense_keys() const {
+    return static_cast<size_t>(capacity_ * MAX_HASHED_LOAD);
+  }
+
+  // Moves every key of the hashed container into a bitmap covering the
+  // exact key range, and frees the bucket array.
+  void to_dense() {
+    KeyT lo = NULL_KEY;
+    KeyT hi = 0;
+    for_each_hashed([&](KeyT key, ValueT) {
+      lo = std::min(lo, key);
+      hi = std::max(hi, key);
+    });
+    if (hi - lo >= sz_ * DENSE_RATIO) {
+      // the tracked range was stale, keys at its ends have been erased
+      lo_ = lo;
+      hi_ = hi;
+      return;
+    }
+
+    base_ = lo;
+    bits_.assign((hi - lo) / 64 + 1, 0);
+    if constexpr (WithValues) {
+      values_.assign(span(), NULL_VALUE);
+    }
+    for_each_hashed([&](KeyT key, ValueT value) {
+      uint64_t off = key - base_;
+      bits_[off / 64] |= uint64_t{1} << (off % 64);
+      if constexpr (WithValues) {
+        values_[off] = value;
+      }
+    });
+    hashed_.reset();
+  }
+
+  // Moves every key of the bitmap into a new hashed container. If one does
+  // not fit, throws and leaves the dense representation as it was.
+  void to_hashed() {
+    Inner& hashed = hashed_.emplace(capacity_);
+    KeyT lo = NULL_KEY;
+    KeyT hi = 0;
+    try {
+      for_each_dense([&](KeyT key, ValueT value) {
+        if constexpr (WithValues) {
+          hashed.insert(key, value);
+        } else {
+          hashed.insert(key);
+        }
+        lo = std::min(lo, key);
+        hi = std::max(hi, key);
+      });
+    } catch (...) {
+      hashed_.reset();
+      throw;
+    }
+
+    lo_ = lo;
+    hi_ = hi;
+    std::vector<uint64_t>().swap(bits_);
+    std::vector<ValueT>().swap(values_);
+    base_ = 0;
+  }
+
+  // Re-bases the dense representation onto [lo, hi].
+  void rebuild_dense(KeyT lo, KeyT hi) {
+    std::vector<uint64_t> bits((hi - lo) / 64 + 1, 0);
+    std::vector<ValueT> values;
+    if constexpr (WithValues) {
+      values.assign(bits.size() * 64, NULL_VALUE);
+    }
+    for_each_dense([&](KeyT key, ValueT value) {
+      uint64_t off = key - lo;
+      bits[off / 64] |= uint64_t{1} << (off % 64);
+      if constexpr (WithValues) {
+        values[off] = value;
+      }
+    });
+
+    base_ = lo;
+    bits_.swap(bits);
+    values_.swap(values);
+  }
+
+  template <class Fn>
+  void for_each_hashed(Fn&& fn) {
+    if constexpr (WithValues) {
+      hashed_->for_each(fn);
+    } else {
+      hashed_->for_each([&](KeyT key) { fn(key, NULL_VALUE); });
+    }
+  }
+
+  template <class Fn>
+  void for_each_dense(Fn&& fn) {
+    for (size_t i = 0; i < bits_.size(); ++i) {
+      for (uint64_t word = bits_[i]; word; word &= word - 1) {
+        uint64_t off = i * 64 + __builtin_ctzll(word);
+        fn(base_ + off, WithValues ? values_[off] : NULL_VALUE);
+      }
+    }
+  }
+
+  size_t capacity_;
+  size_t sz_{0};
+
+  // hashed representation, along with a conservative range of its keys that
+  // erase() does not shrink
+  std::optional<Inner> hashed_;
+  KeyT lo_{NULL_KEY};
+  KeyT hi_{0};
+
+  // dense representation, bit i stands for key base_ + i
+  KeyT base_{0};
+  std::vector<uint64_t> bits_;
+  std::vector<ValueT> values_;
+};
+
+template <class Hash = std::hash<KeyT>,
+          class Allocator = std::allocator<cuckoo_set::Bucket>>
+using adaptive_set =
+    adaptive_container<cuckoo_set::cuckoo_set<Hash, Allocator>, false>;
+
+template <class Hash = std::hash<KeyT>,
+          class Allocator = std::allocator<Bucket>>
+using adaptive_table =
+    adaptive_container<cuckoo_table<Hash, Allocator>, true>;
+
+}  // namespace cuckoo
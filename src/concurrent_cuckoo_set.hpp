@@ -0,0 +1,447 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "cuckoo_set.hpp"
+#include "parallel.hpp"
+#include "table_util.hpp"
+#include "version_lock.hpp"
+#include "xorshift.hpp"
+
+namespace cuckoo_set {
+
+// A cuckoo_set that any number of threads may read and write at once, with
+// lock-free inserts and erases.
+//
+// Slots are single words, so an insert is one compare_exchange of a free
+// slot to the key, and an erase one compare_exchange of the key to
+// TOMB_KEY. Erased slots are not reused until a locked pass turns them back
+// into free slots: since lock-free writers never free a slot, two inserts
+// of one key that each took the first free slot of the key's buckets cannot
+// both succeed without one seeing the other's copy.
+//
+// Only displacement takes locks. Buckets map onto striped version locks as
+// in concurrent_cuckoo_table, and moves, tombstone recycling and the rare
+// cleanup of a duplicate are done with the stripes of both buckets locked.
+// Readers and lock-free writers check that no stripe they depend on moved
+// while they worked; a lookup retries, and a write that overlapped a move
+// settles under the locks instead.
+//
+// Slots are written through std::atomic_ref but searched with the plain
+// NEON loads of Bucket::match_mask, which the C++ memory model calls a data
+// race. It is tolerated because the table targets aarch64, where an aligned
+// 8-byte load, scalar or per vector lane, is single-copy atomic: a search
+// sees each slot either before or after a compare_exchange, never torn, and
+// the stripe versions and fences above order everything else.
+//
+// NULL_KEY and TOMB_KEY are reserved and cannot be inserted.
+template <class Hash = std::hash<KeyT>,
+          class Allocator = std::allocator<Bucket>>
+class concurrent_cuckoo_set {
+ public:
+  static constexpr KeyT TOMB_KEY = NULL_KEY - 1;
+
+  concurrent_cuckoo_set(size_t capacity)
+      : hash_fn_(),
+        allocator_(),
+        num_buckets_(cuckoo::detail::next_pow2(capacity) / SLOTS_PER_BUCKET),
+        bucket_bitmask_(num_buckets_ - 1),
+        buckets_(allocator_.allocate(num_buckets_)) {
+    if ((uint64_t)(buckets_) % hardware_constructive_interference_size != 0) {
+      allocator_.deallocate(buckets_, num_buckets_);
+      throw std::runtime_error("buckets_ is not cache-aligned");
+    }
+
+    Bucket empty;
+    empty.key_slots.fill(NULL_KEY);
+    cuckoo::parallel_for(num_buckets_, PARALLEL_MIN_BUCKETS,
+                         [&](size_t begin, size_t end) {
+                           std::fill(buckets_ + begin, buckets_ + end, empty);
+                         });
+  }
+
+  concurrent_cuckoo_set(const concurrent_cuckoo_set&) = delete;
+  concurrent_cuckoo_set& operator=(const concurrent_cuckoo_set&) = delete;
+
+  ~concurrent_cuckoo_set() { allocator_.deallocate(buckets_, num_buckets_); }
+
+  size_t size() const {
+    int64_t sz = 0;
+    for (const size_shard& shard : size_shards_) {
+      sz += shard.sz.load(std::memory_order_relaxed);
+    }
+    return static_cast<size_t>(std::max<int64_t>(sz, 0));
+  }
+
+  // Throws std::invalid_argument for NULL_KEY and TOMB_KEY, as do the other
+  // operations.
+  bool contains(KeyT key) {
+    check_key(key);
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    bool found;
+    while (!try_contains(key, bucket_id1, bucket_id2, found)) {
+    }
+    return found;
+  }
+
+  // Looks up keys in batches of MAX_LOOKUP_BATCH_SZ, prefetching the buckets
+  // of a whole batch before searching any of them.
+  void contains_batched(const KeyT* keys, size_t num_keys, bool* results) {
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(MAX_LOOKUP_BATCH_SZ, num_keys - base);
+
+      for (size_t i = 0; i < batch_sz; ++i) {
+        check_key(keys[base + i]);
+        size_t hash = hash_key(keys[base + i]);
+        bucket_id1s[i] = get_bucket_id(hash);
+        bucket_id2s[i] = get_other_bucket_id(hash, keys[base + i]);
+        __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
+        __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
+      }
+
+      for (size_t i = 0; i < batch_sz; ++i) {
+        while (!try_contains(keys[base + i], bucket_id1s[i], bucket_id2s[i],
+                             results[base + i])) {
+        }
+      }
+    }
+  }
+
+  // Returns whether the key was added. Of several threads racing to insert
+  // the same key, exactly one sees true. Throws std::invalid_argument for
+  // NULL_KEY and TOMB_KEY, and std::runtime_error if no room can be made.
+  bool insert(KeyT key) {
+    check_key(key);
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    for (size_t attempt = 0; attempt < MAX_PATH_ATTEMPTS; ++attempt) {
+      switch (try_insert(key, bucket_id1, bucket_id2)) {
+        case insert_result::inserted:
+          return true;
+        case insert_result::exists:
+          return false;
+        case insert_result::full:
+          break;
+      }
+      if (!recycle_tombs(bucket_id1, bucket_id2)) {
+        make_room(attempt % 2 ? bucket_id2 : bucket_id1);
+      }
+    }
+    throw std::runtime_error{"cannot find insertion slot."};
+  }
+
+  // Returns whether the key was present.
+  bool erase(KeyT key) {
+    check_key(key);
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    uint64_t v1 = stripe(bucket_id1).read_begin();
+    uint64_t v2 = stripe(bucket_id2).read_begin();
+    size_t num_erased = 0;
+    for (uint32_t found = match_mask_pair(bucket_id1, bucket_id2, key); found;
+         found &= found - 1) {
+      KeyT expected = key;
+      num_erased += slot(bucket_id1, bucket_id2, __builtin_ctz(found))
+                        .compare_exchange_strong(expected, TOMB_KEY);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!num_erased && (!stripe(bucket_id1).read_validate(v1) ||
+                        !stripe(bucket_id2).read_validate(v2))) {
+      // a move may have carried the key past the search
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      num_erased += clear_locked(key, bucket_id1, bucket_id2,
+                                 match_mask_pair(bucket_id1, bucket_id2, key));
+    }
+    add_size(bucket_id1, -static_cast<int64_t>(num_erased));
+    return num_erased > 0;
+  }
+
+ private:
+  static constexpr size_t NUM_STRIPES = 1024;
+  static constexpr size_t NUM_SIZE_SHARDS = 64;
+  static constexpr size_t MAX_PATH_LEN = 256;
+  static constexpr size_t MAX_PATH_ATTEMPTS = 16;
+  static constexpr size_t PARALLEL_MIN_BUCKETS =
+      cuckoo::detail::parallel_min_buckets<Bucket>();
+
+  enum class insert_result { inserted, exists, full };
+
+  // Holds the stripes of two buckets, locked in index order so that writers
+  // cannot deadlock.
+  class pair_lock {
+   public:
+    pair_lock(concurrent_cuckoo_set& set, size_t bucket_id1,
+              size_t bucket_id2) {
+      size_t s1 = bucket_id1 & (NUM_STRIPES - 1);
+      size_t s2 = bucket_id2 & (NUM_STRIPES - 1);
+      first_ = &set.locks_[std::min(s1, s2)];
+      second_ = s1 == s2 ? nullptr : &set.locks_[std::max(s1, s2)];
+      first_->lock();
+      if (second_) {
+        second_->lock();
+      }
+      // pairs with the fence lock-free writers take before validating: either
+      // they see the odd version, or the slot writes below see theirs
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    pair_lock(const pair_lock&) = delete;
+    pair_lock& operator=(const pair_lock&) = delete;
+
+    ~pair_lock() {
+      if (second_) {
+        second_->unlock();
+      }
+      first_->unlock();
+    }
+
+   private:
+    cuckoo::version_lock* first_;
+    cuckoo::version_lock* second_;
+  };
+
+  // keeps each shard of the size on its own cache line
+  struct alignas(hardware_constructive_interference_size) size_shard {
+    std::atomic<int64_t> sz{0};
+  };
+
+  // NULL_KEY and TOMB_KEY would match free and erased slots.
+  static void check_key(KeyT key) {
+    if (key == NULL_KEY || key == TOMB_KEY) {
+      throw std::invalid_argument{"NULL_KEY and TOMB_KEY are reserved"};
+    }
+  }
+
+  const cuckoo::version_lock& stripe(size_t bucket_id) const {
+    return locks_[bucket_id & (NUM_STRIPES - 1)];
+  }
+
+  // Slot `pos` of the two buckets taken as one, the first bucket's first.
+  std::atomic_ref<KeyT> slot(size_t bucket_id1, size_t bucket_id2,
+                             size_t pos) {
+    Bucket& bucket = buckets_[pos < SLOTS_PER_BUCKET ? bucket_id1 : bucket_id2];
+    return std::atomic_ref<KeyT>(
+        bucket.key_slots[pos & (SLOTS_PER_BUCKET - 1)]);
+  }
+
+  Bucket load_bucket(size_t bucket_id) {
+    Bucket bucket;
+    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+      bucket.key_slots[i] =
+          std::atomic_ref<KeyT>(buckets_[bucket_id].key_slots[i])
+              .load(std::memory_order_relaxed);
+    }
+    return bucket;
+  }
+
+  // One bit per slot of the two buckets holding `key`, in slot() order.
+  static uint32_t match_mask_pair(const Bucket& b1, const Bucket& b2,
+                                  KeyT key) {
+    return b1.match_mask(key) | (b2.match_mask(key) << SLOTS_PER_BUCKET);
+  }
+
+  uint32_t match_mask_pair(size_t bucket_id1, size_t bucket_id2, KeyT key) {
+    if (bucket_id1 == bucket_id2) {
+      return buckets_[bucket_id1].match_mask(key);
+    }
+    return match_mask_pair(buckets_[bucket_id1], buckets_[bucket_id2], key);
+  }
+
+  void add_size(size_t bucket_id1, int64_t delta) {
+    if (delta) {
+      size_shards_[bucket_id1 & (NUM_SIZE_SHARDS - 1)].sz.fetch_add(
+          delta, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false if a move overlapped the search and it must be retried.
+  // A hit needs no check, keys only ever move by being copied first.
+  bool try_contains(KeyT key, size_t bucket_id1, size_t bucket_id2,
+                    bool& found) {
+    uint64_t v1 = stripe(bucket_id1).read_begin();
+    uint64_t v2 = stripe(bucket_id2).read_begin();
+    found = match_mask_pair(bucket_id1, bucket_id2, key) != 0;
+    return found || (stripe(bucket_id1).read_validate(v1) &&
+                     stripe(bucket_id2).read_validate(v2));
+  }
+
+  insert_result try_insert(KeyT key, size_t bucket_id1, size_t bucket_id2) {
+    while (true) {
+      uint64_t v1 = stripe(bucket_id1).read_begin();
+      uint64_t v2 = stripe(bucket_id2).read_begin();
+      // read each slot once, so that the search for the key and the choice
+      // of the first free slot see the same buckets
+      const Bucket b1 = load_bucket(bucket_id1);
+      Bucket b2 = load_bucket(bucket_id2);
+      if (bucket_id2 == bucket_id1) {
+        b2.key_slots.fill(TOMB_KEY);
+      }
+      if (match_mask_pair(b1, b2, key)) {
+        return insert_result::exists;
+      }
+      uint32_t empty = match_mask_pair(b1, b2, NULL_KEY);
+      if (!empty) {
+        return insert_result::full;
+      }
+
+      KeyT expected = NULL_KEY;
+      if (!slot(bucket_id1, bucket_id2, __builtin_ctz(empty))
+               .compare_exchange_strong(expected, key)) {
+        continue;
+      }
+      add_size(bucket_id1, 1);
+
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (stripe(bucket_id1).read_validate(v1) &&
+          stripe(bucket_id2).read_validate(v2)) {
+        return insert_result::inserted;
+      }
+      // A slot freed under the locks while we searched may have let a racing
+      // insert of the key through, so keep only the first copy. Either we
+      // are the racing insert, or the other one settles here after us.
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      uint32_t copies = match_mask_pair(bucket_id1, bucket_id2, key);
+      if ((copies & (copies - 1)) == 0) {
+        return insert_result::inserted;
+      }
+      add_size(bucket_id1, -static_cast<int64_t>(clear_locked(
+                               key, bucket_id1, bucket_id2,
+                               copies & (copies - 1))));
+      return insert_result::exists;
+    }
+  }
+
+  // Must hold the key's stripes. Frees the slots in `mask` that still hold
+  // the key and returns how many did.
+  size_t clear_locked(KeyT key, size_t bucket_id1, size_t bucket_id2,
+                      uint32_t mask) {
+    size_t num_cleared = 0;
+    for (; mask; mask &= mask - 1) {
+      KeyT expected = key;
+      num_cleared += slot(bucket_id1, bucket_id2, __builtin_ctz(mask))
+                         .compare_exchange_strong(expected, NULL_KEY);
+    }
+    return num_cleared;
+  }
+
+  // Must hold the bucket's stripe. Lock-free writers leave tombstones alone,
+  // so they can be freed with plain stores.
+  bool recycle_tombs_locked(size_t bucket_id) {
+    uint32_t tombs = buckets_[bucket_id].match_mask(TOMB_KEY);
+    for (uint32_t mask = tombs; mask; mask &= mask - 1) {
+      std::atomic_ref<KeyT>(buckets_[bucket_id].key_slots[__builtin_ctz(mask)])
+          .store(NULL_KEY, std::memory_order_relaxed);
+    }
+    return tombs != 0;
+  }
+
+  bool recycle_tombs(size_t bucket_id1, size_t bucket_id2) {
+    pair_lock lock(*this, bucket_id1, bucket_id2);
+    bool recycled = recycle_tombs_locked(bucket_id1);
+    return recycle_tombs_locked(bucket_id2) || recycled;
+  }
+
+  // Frees a slot in `bucket_id` as concurrent_cuckoo_table does, walking a
+  // random cuckoo path without locks and then moving its keys back along it
+  // under the locks of each move's two buckets. A key is copied to its new
+  // slot before its old one is freed, and a move whose key was erased or
+  // whose target slot was taken meanwhile gives up.
+  bool make_room(size_t bucket_id) {
+    static thread_local cuckoo::xorshift64 rng;
+
+    struct step {
+      size_t bucket_id;
+      size_t slot_idx;
+      KeyT key;
+    };
+    std::array<step, MAX_PATH_LEN> path;
+    size_t len = 0;
+
+    size_t curr = bucket_id;
+    while (!(buckets_[curr].match_mask(NULL_KEY) |
+             buckets_[curr].match_mask(TOMB_KEY))) {
+      if (len == MAX_PATH_LEN) {
+        return false;
+      }
+      size_t slot_idx = (rng() >> 32) & (SLOTS_PER_BUCKET - 1);
+      KeyT victim = std::atomic_ref<KeyT>(buckets_[curr].key_slots[slot_idx])
+                        .load(std::memory_order_relaxed);
+      if (victim == NULL_KEY || victim == TOMB_KEY) {
+        continue;  // erased since the bucket was checked
+      }
+      size_t hash = hash_key(victim);
+      size_t victim_id1 = get_bucket_id(hash);
+      size_t victim_id2 = get_other_bucket_id(hash, victim);
+      path[len++] = {curr, slot_idx, victim};
+      curr = victim_id1 == curr ? victim_id2 : victim_id1;
+    }
+
+    for (size_t i = len; i-- > 0;) {
+      const step& s = path[i];
+      size_t to = i + 1 < len ? path[i + 1].bucket_id : curr;
+
+      pair_lock lock(*this, s.bucket_id, to);
+      recycle_tombs_locked(to);
+      size_t to_slot_idx = buckets_[to].find_empty();
+      if (to_slot_idx == NULL_SLOT_IDX) {
+        return false;
+      }
+      std::atomic_ref<KeyT> from(buckets_[s.bucket_id].key_slots[s.slot_idx]);
+      std::atomic_ref<KeyT> target(buckets_[to].key_slots[to_slot_idx]);
+      KeyT expected = NULL_KEY;
+      if (from.load(std::memory_order_relaxed) != s.key ||
+          !target.compare_exchange_strong(expected, s.key)) {
+        return false;
+      }
+      expected = s.key;
+      if (!from.compare_exchange_strong(expected, NULL_KEY)) {
+        // erased while being copied, take the copy back unless the erase
+        // took it too, in which case it counted the key twice
+        expected = s.key;
+        if (!target.compare_exchange_strong(expected, NULL_KEY)) {
+          add_size(get_bucket_id(hash_key(s.key)), 1);
+        }
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t hash_key(KeyT key) { return hash_fn_(key); }
+  size_t get_bucket_id(size_t h) {
+    return cuckoo::detail::primary_bucket_id(h, bucket_bitmask_);
+  }
+  size_t get_other_bucket_id(size_t h, KeyT k) {
+    return cuckoo::detail::alternate_bucket_id(hash_fn_, h, k, bucket_bitmask_);
+  }
+
+  Hash hash_fn_;
+  Allocator allocator_;
+
+  size_t num_buckets_;
+  size_t bucket_bitmask_;
+  Bucket* buckets_;
+
+  std::array<cuckoo::version_lock, NUM_STRIPES> locks_;
+  // sharded by bucket so that writers of different keys rarely share a line
+  std::array<size_shard, NUM_SIZE_SHARDS> size_shards_;
+};
+
+}  // namespace cuckoo_set
@@ -0,0 +1,680 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include "cuckoo_table.hpp"
+#include "parallel.hpp"
+#include "table_util.hpp"
+#include "version_lock.hpp"
+#include "xorshift.hpp"
+
+namespace cuckoo {
+
+// A cuckoo_table that any number of threads may read and write at once.
+//
+// Buckets map onto a fixed array of striped version locks. Writers lock the
+// stripes of both buckets of a key, while readers take no locks: they search
+// both buckets and retry if either stripe's version moved in the meantime.
+//
+// An insert that finds both of its buckets full parks the entry in a small
+// pending buffer, which lookups and erases search as well, and returns. A
+// background worker then frees a slot by moving entries along a cuckoo path,
+// one locked move at a time, and moves the entry into the table, so inserts
+// never wait on a long eviction chain unless the buffer is full. With
+// `background_relocation` off, inserts do the moves themselves.
+//
+// Lookups return copies of values, since entries may move at any time.
+template <class Hash = std::hash<KeyT>,
+          class Allocator = std::allocator<Bucket>>
+class concurrent_cuckoo_table {
+ public:
+  concurrent_cuckoo_table(size_t capacity, bool background_relocation = true)
+      : hash_fn_(),
+        allocator_(),
+        num_buckets_(detail::next_pow2(capacity) / SLOTS_PER_BUCKET),
+        bucket_bitmask_(num_buckets_ - 1),
+        buckets_(allocator_.allocate(num_buckets_)) {
+    if ((uint64_t)(buckets_) % hardware_constructive_interference_size != 0) {
+      allocator_.deallocate(buckets_, num_buckets_);
+      throw std::runtime_error("buckets_ is not cache-aligned");
+    }
+
+    Bucket empty;
+    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+      empty.erase(i);
+    }
+    parallel_for(num_buckets_, PARALLEL_MIN_BUCKETS,
+                 [&](size_t begin, size_t end) {
+                   std::fill(buckets_ + begin, buckets_ + end, empty);
+                 });
+
+    if (background_relocation) {
+      worker_ = std::thread([this] { relocation_loop(); });
+    }
+  }
+
+  concurrent_cuckoo_table(const concurrent_cuckoo_table&) = delete;
+  concurrent_cuckoo_table& operator=(const concurrent_cuckoo_table&) = delete;
+
+  ~concurrent_cuckoo_table() {
+    if (worker_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        stop_ = true;
+      }
+      pending_cv_.notify_all();
+      worker_.join();
+    }
+    allocator_.deallocate(buckets_, num_buckets_);
+  }
+
+  // Counts entries in the pending buffer too.
+  size_t size() const { return sz_.load(std::memory_order_relaxed); }
+
+  // NULL_KEY marks empty slots and is never found.
+  std::optional<ValueT> find(KeyT key) {
+    if (key == NULL_KEY) {
+      return std::nullopt;
+    }
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    std::optional<ValueT> result;
+    while (!try_find(key, bucket_id1, bucket_id2, result)) {
+    }
+    return result;
+  }
+
+  // Looks up keys in batches of MAX_LOOKUP_BATCH_SZ, prefetching the buckets
+  // of a whole batch before searching any of them.
+  void find_batched(const KeyT* keys, size_t num_keys,
+                    std::optional<ValueT>* results) {
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(MAX_LOOKUP_BATCH_SZ, num_keys - base);
+
+      for (size_t i = 0; i < batch_sz; ++i) {
+        size_t hash = hash_key(keys[base + i]);
+        bucket_id1s[i] = get_bucket_id(hash);
+        bucket_id2s[i] = get_other_bucket_id(hash, keys[base + i]);
+        __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
+        __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
+      }
+
+      for (size_t i = 0; i < batch_sz; ++i) {
+        if (keys[base + i] == NULL_KEY) {
+          results[base + i].reset();
+          continue;
+        }
+        while (!try_find(keys[base + i], bucket_id1s[i], bucket_id2s[i],
+                         results[base + i])) {
+        }
+      }
+    }
+  }
+
+  // Throws if the key exists, or if no room can be made for it. Throws
+  // std::invalid_argument for NULL_KEY, which marks empty slots.
+  void insert(KeyT key, ValueT value) {
+    check_key(key);
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    {
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      switch (try_insert_locked(key, value, bucket_id1, bucket_id2)) {
+        case insert_result::inserted:
+          return;
+        case insert_result::exists:
+          throw std::runtime_error{"tried to insert existing key"};
+        case insert_result::full:
+          if (try_park_locked(key, value)) {
+            pending_cv_.notify_one();
+            return;
+          }
+          break;
+      }
+    }
+
+    if (!relocate_and_insert(key, value, bucket_id1, bucket_id2)) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+  }
+
+  // An assign sets the key's value whether or not the key is present.
+  struct write_op {
+    enum class Type : uint8_t { insert, erase, assign };
+
+    Type type;
+    KeyT key;
+    ValueT value{NULL_VALUE};
+
+    // set by write_batched(): whether the key was present when the op was
+    // applied, in which case an insert leaves the table unchanged and an
+    // assign replaces the value
+    bool found{false};
+    // set by write_batched() once the op has taken effect
+    bool applied{false};
+  };
+
+  // Applies a batch of inserts, erases and assigns in order, as the
+  // equivalent calls to insert() and erase() would, except that an insert of
+  // an existing key only sets `found`. Each chunk of up to WRITE_BATCH_SZ ops
+  // prefetches its buckets for writing, then locks every stripe it touches
+  // once, in index order, and applies all of its ops under those locks. An
+  // insert that needs entries moved releases them and continues after it.
+  // Throws if no room can be made for an insert, leaving it and the ops
+  // after it with `applied` unset. Throws std::invalid_argument, before
+  // applying any op, if one is on NULL_KEY.
+  void write_batched(write_op* ops, size_t num_ops) {
+    for (size_t i = 0; i < num_ops; ++i) {
+      check_key(ops[i].key);
+    }
+    std::array<size_t, WRITE_BATCH_SZ> bucket_id1s;
+    std::array<size_t, WRITE_BATCH_SZ> bucket_id2s;
+    std::array<size_t, 2 * WRITE_BATCH_SZ> stripes;
+
+    size_t begin = 0;
+    while (begin < num_ops) {
+      size_t batch_sz = std::min(WRITE_BATCH_SZ, num_ops - begin);
+      write_op* batch = ops + begin;
+
+      size_t num_stripes = 0;
+      for (size_t i = 0; i < batch_sz; ++i) {
+        size_t hash = hash_key(batch[i].key);
+        bucket_id1s[i] = get_bucket_id(hash);
+        bucket_id2s[i] = get_other_bucket_id(hash, batch[i].key);
+        __builtin_prefetch(&buckets_[bucket_id1s[i]], 1, 3);
+        __builtin_prefetch(&buckets_[bucket_id2s[i]], 1, 3);
+        stripes[num_stripes++] = bucket_id1s[i] & (NUM_STRIPES - 1);
+        stripes[num_stripes++] = bucket_id2s[i] & (NUM_STRIPES - 1);
+      }
+      std::sort(stripes.begin(), stripes.begin() + num_stripes);
+      num_stripes =
+          std::unique(stripes.begin(), stripes.begin() + num_stripes) -
+          stripes.begin();
+
+      size_t num_applied = 0;
+      bool needs_room = false;
+      bool notify = false;
+      for (size_t i = 0; i < num_stripes; ++i) {
+        locks_[stripes[i]].lock();
+      }
+      for (; num_applied < batch_sz && !needs_room; ++num_applied) {
+        write_op& op = batch[num_applied];
+        size_t bucket_id1 = bucket_id1s[num_applied];
+        size_t bucket_id2 = bucket_id2s[num_applied];
+        if (op.type == write_op::Type::erase) {
+          op.found = erase_locked(op.key, bucket_id1, bucket_id2);
+          op.applied = true;
+          notify |= op.found;
+          continue;
+        }
+        if (op.type == write_op::Type::assign &&
+            assign_locked(op.key, op.value, bucket_id1, bucket_id2)) {
+          op.found = true;
+          op.applied = true;
+          continue;
+        }
+        insert_result result =
+            try_insert_locked(op.key, op.value, bucket_id1, bucket_id2);
+        op.found = result == insert_result::exists;
+        if (result == insert_result::full) {
+          needs_room = !try_park_locked(op.key, op.value);
+          notify |= !needs_room;
+        }
+        op.applied = !needs_room;
+      }
+      for (size_t i = num_stripes; i-- > 0;) {
+        locks_[stripes[i]].unlock();
+      }
+
+      if (notify) {
+        notify_relocation();
+      }
+      if (needs_room) {
+        write_op& op = batch[num_applied - 1];
+        op.found = !relocate_and_insert(
+            op.key, op.value, bucket_id1s[num_applied - 1],
+            bucket_id2s[num_applied - 1], op.type == write_op::Type::assign);
+        op.applied = true;
+      }
+      begin += num_applied;
+    }
+  }
+
+  // Returns whether the key was present. Throws std::invalid_argument for
+  // NULL_KEY.
+  bool erase(KeyT key) {
+    check_key(key);
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    bool erased;
+    {
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      erased = erase_locked(key, bucket_id1, bucket_id2);
+    }
+    if (erased) {
+      notify_relocation();
+    }
+    return erased;
+  }
+
+  // Blocks until the worker has moved every parked entry into the table, or
+  // has given up on the rest until the next erase frees room.
+  void wait_for_relocations() {
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    settled_cv_.wait(lock, [this] {
+      return !worker_.joinable() || settled_gen_ == pending_gen_;
+    });
+  }
+
+ private:
+  static constexpr size_t NUM_STRIPES = 1024;
+  static constexpr size_t PENDING_SZ = 64;
+  static constexpr size_t MAX_PATH_LEN = 256;
+  static constexpr size_t MAX_PATH_ATTEMPTS = 16;
+  static constexpr size_t PARALLEL_MIN_BUCKETS =
+      detail::parallel_min_buckets<Bucket>();
+  static constexpr size_t WRITE_BATCH_SZ = 64;
+
+  enum class insert_result { inserted, exists, full };
+
+  // Holds the stripes of two buckets, locked in index order so that writers
+  // cannot deadlock.
+  class pair_lock {
+   public:
+    pair_lock(concurrent_cuckoo_table& table, size_t bucket_id1,
+              size_t bucket_id2) {
+      size_t s1 = bucket_id1 & (NUM_STRIPES - 1);
+      size_t s2 = bucket_id2 & (NUM_STRIPES - 1);
+      first_ = &table.locks_[std::min(s1, s2)];
+      second_ = s1 == s2 ? nullptr : &table.locks_[std::max(s1, s2)];
+      first_->lock();
+      if (second_) {
+        second_->lock();
+      }
+    }
+
+    pair_lock(const pair_lock&) = delete;
+    pair_lock& operator=(const pair_lock&) = delete;
+
+    ~pair_lock() {
+      if (second_) {
+        second_->unlock();
+      }
+      first_->unlock();
+    }
+
+   private:
+    version_lock* first_;
+    version_lock* second_;
+  };
+
+  static void check_key(KeyT key) {
+    if (key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+  }
+
+  const version_lock& stripe(size_t bucket_id) const {
+    return locks_[bucket_id & (NUM_STRIPES - 1)];
+  }
+
+  // Returns false if a writer overlapped the read and it must be retried.
+  bool try_find(KeyT key, size_t bucket_id1, size_t bucket_id2,
+                std::optional<ValueT>& result) {
+    uint64_t v1 = stripe(bucket_id1).read_begin();
+    uint64_t v2 = stripe(bucket_id2).read_begin();
+
+    Bucket::iterator it = Bucket::find_pair_simd(buckets_[bucket_id1],
+                                                 buckets_[bucket_id2], key);
+    if (!it.is_null()) {
+      result = it.value();
+    } else if (pending_count_.load(std::memory_order_acquire)) {
+      // An entry leaves the buffer only with its stripes locked, so if it
+      // left after the buckets were searched, validation below fails.
+      result = find_pending(key);
+    } else {
+      result.reset();
+    }
+
+    return stripe(bucket_id1).read_validate(v1) &&
+           stripe(bucket_id2).read_validate(v2);
+  }
+
+  // Must hold the key's stripes.
+  insert_result try_insert_locked(KeyT key, ValueT value, size_t bucket_id1,
+                                  size_t bucket_id2) {
+    Bucket::iterator it = Bucket::find_pair_simd(buckets_[bucket_id1],
+                                                 buckets_[bucket_id2], key);
+    if (!it.is_null() ||
+        (pending_count_.load(std::memory_order_relaxed) && find_pending(key))) {
+      return insert_result::exists;
+    }
+    if (!Bucket::insert_pair(buckets_[bucket_id1], buckets_[bucket_id2], key,
+                             value)) {
+      return insert_result::full;
+    }
+    sz_.fetch_add(1, std::memory_order_relaxed);
+    return insert_result::inserted;
+  }
+
+  // Makes room on the calling thread, for when there is no worker or its
+  // buffer is full. Returns false if the key turned out to exist, in which
+  // case `assign` replaces its value, and throws if no room could be made.
+  bool relocate_and_insert(KeyT key, ValueT value, size_t bucket_id1,
+                           size_t bucket_id2, bool assign = false) {
+    for (size_t attempt = 0; attempt < MAX_PATH_ATTEMPTS; ++attempt) {
+      make_room(attempt % 2 ? bucket_id2 : bucket_id1);
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      switch (try_insert_locked(key, value, bucket_id1, bucket_id2)) {
+        case insert_result::inserted:
+          return true;
+        case insert_result::exists:
+          if (assign) {
+            assign_locked(key, value, bucket_id1, bucket_id2);
+          }
+          return false;
+        case insert_result::full:
+          break;
+      }
+    }
+    throw std::runtime_error{"cannot find insertion slot."};
+  }
+
+  // Must hold the key's stripes.
+  bool erase_locked(KeyT key, size_t bucket_id1, size_t bucket_id2) {
+    Bucket::iterator it = Bucket::find_pair_simd(buckets_[bucket_id1],
+                                                 buckets_[bucket_id2], key);
+    if (!it.is_null()) {
+      it.bucket_->erase(it.slot_idx_);
+    } else if (!pending_count_.load(std::memory_order_relaxed) ||
+               !erase_pending(key)) {
+      return false;
+    }
+    sz_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Must hold the key's stripes. Replaces the key's value, in its bucket or
+  // in the buffer, and returns false if the key is absent.
+  bool assign_locked(KeyT key, ValueT value, size_t bucket_id1,
+                     size_t bucket_id2) {
+    Bucket::iterator it = Bucket::find_pair_simd(buckets_[bucket_id1],
+                                                 buckets_[bucket_id2], key);
+    if (!it.is_null()) {
+      it.value() = value;
+      return true;
+    }
+    return pending_count_.load(std::memory_order_relaxed) &&
+           assign_pending(key, value);
+  }
+
+  // Wakes the worker after an entry was parked or a slot was freed, if it
+  // has parked entries to place.
+  void notify_relocation() {
+    if (!pending_count_.load(std::memory_order_acquire)) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      pending_gen_++;
+    }
+    pending_cv_.notify_one();
+  }
+
+  // Must hold the key's stripes, and the key must be absent. Fails if there
+  // is no worker or its buffer is full.
+  bool try_park_locked(KeyT key, ValueT value) {
+    if (!worker_.joinable()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    size_t count = pending_count_.load(std::memory_order_relaxed);
+    if (count == PENDING_SZ) {
+      return false;
+    }
+    {
+      std::lock_guard<version_lock> write(pending_version_);
+      pending_[count].store(key, value);
+      pending_count_.store(count + 1, std::memory_order_release);
+    }
+    pending_gen_++;
+    sz_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Searches the buffer without pending_mutex_, as a seqlock reader of
+  // pending_version_, retrying if a writer changed the buffer meanwhile.
+  std::optional<ValueT> find_pending(KeyT key) const {
+    while (true) {
+      uint64_t v = pending_version_.read_begin();
+      std::optional<ValueT> result;
+      size_t count = pending_count_.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < count; ++i) {
+        if (pending_[i].key.load(std::memory_order_relaxed) == key) {
+          result = pending_[i].value.load(std::memory_order_relaxed);
+          break;
+        }
+      }
+      if (pending_version_.read_validate(v)) {
+        return result;
+      }
+    }
+  }
+
+  // Must hold pending_mutex_. Fills the hole at `idx` with the last entry.
+  void remove_pending_locked(size_t idx, size_t count) {
+    std::lock_guard<version_lock> write(pending_version_);
+    pending_[idx].store(
+        pending_[count - 1].key.load(std::memory_order_relaxed),
+        pending_[count - 1].value.load(std::memory_order_relaxed));
+    pending_count_.store(count - 1, std::memory_order_release);
+  }
+
+  // Must hold the key's stripes.
+  bool erase_pending(KeyT key) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    size_t count = pending_count_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+      if (pending_[i].key.load(std::memory_order_relaxed) == key) {
+        remove_pending_locked(i, count);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Must hold the key's stripes.
+  bool assign_pending(KeyT key, ValueT value) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    size_t count = pending_count_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+      if (pending_[i].key.load(std::memory_order_relaxed) == key) {
+        std::lock_guard<version_lock> write(pending_version_);
+        pending_[i].value.store(value, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Moves a parked entry into the table if there is room in its buckets,
+  // making room first if needed. Returns false if it could not, or if the
+  // entry was erased meanwhile.
+  bool place_pending(KeyT key) {
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    for (size_t attempt = 0; attempt <= MAX_PATH_ATTEMPTS; ++attempt) {
+      if (attempt > 0) {
+        make_room(attempt % 2 ? bucket_id1 : bucket_id2);
+      }
+
+      pair_lock lock(*this, bucket_id1, bucket_id2);
+      std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+      size_t count = pending_count_.load(std::memory_order_relaxed);
+      size_t idx = 0;
+      while (idx < count &&
+             pending_[idx].key.load(std::memory_order_relaxed) != key) {
+        idx++;
+      }
+      if (idx == count) {
+        return false;
+      }
+
+      // cannot throw, the key is not in the table while it is parked
+      ValueT value = pending_[idx].value.load(std::memory_order_relaxed);
+      if (Bucket::insert_pair(buckets_[bucket_id1], buckets_[bucket_id2], key,
+                              value)) {
+        remove_pending_locked(idx, count);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void relocation_loop() {
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    while (!stop_) {
+      uint64_t gen = pending_gen_;
+      std::array<KeyT, PENDING_SZ> keys;
+      size_t count = pending_count_.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < count; ++i) {
+        keys[i] = pending_[i].key.load(std::memory_order_relaxed);
+      }
+
+      lock.unlock();
+      size_t num_placed = 0;
+      for (size_t i = 0; i < count; ++i) {
+        num_placed += place_pending(keys[i]);
+      }
+      lock.lock();
+
+      if (num_placed > 0) {
+        continue;
+      }
+      // everything parked so far is placed or stuck, sleep until that changes
+      settled_gen_ = gen;
+      settled_cv_.notify_all();
+      pending_cv_.wait(lock, [&] { return stop_ || pending_gen_ != gen; });
+    }
+  }
+
+  // Frees a slot in `bucket_id` by walking a random cuckoo path from it to a
+  // bucket with a free slot, then moving the entries on it back along the
+  // path, the last one first, each under the locks of its own two buckets.
+  // The path is found without locks, so a move that finds its entry or its
+  // target slot changed gives up. Returns whether a slot was freed.
+  bool make_room(size_t bucket_id) {
+    static thread_local xorshift64 rng;
+
+    struct step {
+      size_t bucket_id;
+      size_t slot_idx;
+      KeyT key;
+    };
+    std::array<step, MAX_PATH_LEN> path;
+    size_t len = 0;
+
+    size_t curr = bucket_id;
+    while (buckets_[curr].find_empty() == NULL_SLOT_IDX) {
+      if (len == MAX_PATH_LEN) {
+        return false;
+      }
+      size_t slot_idx = (rng() >> 32) & (SLOTS_PER_BUCKET - 1);
+      KeyT victim = buckets_[curr].key_slots[slot_idx];
+      if (victim == NULL_KEY) {
+        continue;  // erased since the bucket was checked
+      }
+      size_t hash = hash_key(victim);
+      size_t victim_id1 = get_bucket_id(hash);
+      size_t victim_id2 = get_other_bucket_id(hash, victim);
+      path[len++] = {curr, slot_idx, victim};
+      curr = victim_id1 == curr ? victim_id2 : victim_id1;
+    }
+
+    for (size_t i = len; i-- > 0;) {
+      const step& s = path[i];
+      size_t to = i + 1 < len ? path[i + 1].bucket_id : curr;
+
+      pair_lock lock(*this, s.bucket_id, to);
+      Bucket& from_bucket = buckets_[s.bucket_id];
+      size_t to_slot_idx = buckets_[to].find_empty();
+      if (from_bucket.key_slots[s.slot_idx] != s.key ||
+          to_slot_idx == NULL_SLOT_IDX) {
+        return false;
+      }
+      buckets_[to].update(to_slot_idx, s.key,
+                          from_bucket.value_slots[s.slot_idx]);
+      from_bucket.erase(s.slot_idx);
+    }
+    return true;
+  }
+
+  size_t hash_key(KeyT key) { return hash_fn_(key); }
+  size_t get_bucket_id(size_t h) {
+    return detail::primary_bucket_id(h, bucket_bitmask_);
+  }
+  size_t get_other_bucket_id(size_t h, KeyT k) {
+    return detail::alternate_bucket_id(hash_fn_, h, k, bucket_bitmask_);
+  }
+
+  Hash hash_fn_;
+  Allocator allocator_;
+
+  size_t num_buckets_;
+  size_t bucket_bitmask_;
+  Bucket* buckets_;
+
+  std::atomic<size_t> sz_{0};
+  std::array<version_lock, NUM_STRIPES> locks_;
+
+  // A parked entry. Its fields are atomic so that lookups can read them while
+  // a writer replaces them, see find_pending().
+  struct pending_entry {
+    std::atomic<KeyT> key;
+    std::atomic<ValueT> value;
+
+    void store(KeyT k, ValueT v) {
+      key.store(k, std::memory_order_relaxed);
+      value.store(v, std::memory_order_relaxed);
+    }
+  };
+
+  // Parked entries. Writers hold pending_mutex_ and, while they change the
+  // buffer, pending_version_; lookups read it under pending_version_ alone.
+  // The count is also read on its own so that lookups can skip the buffer
+  // while it is empty.
+  std::mutex pending_mutex_;
+  version_lock pending_version_;
+  std::array<pending_entry, PENDING_SZ> pending_;
+  std::atomic<size_t> pending_count_{0};
+  // bumped whenever an entry is parked or room is freed for parked entries
+  uint64_t pending_gen_{0};
+  uint64_t settled_gen_{0};
+  bool stop_{false};
+  std::condition_variable pending_cv_;
+  std::condition_variable settled_cv_;
+  std::thread worker_;
+};
+
+}  // namespace cuckoo
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cstring>
 #include <memory>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include <arm_neon.h>
 
+#include "access_sampler.hpp"
+#include "memory_usage.hpp"
+#include "parallel.hpp"
+#include "sve.hpp"
+#include "table_util.hpp"
+#include "xorshift.hpp"
+
 namespace cuckoo_set {
 
 // assume cache line size is 64B
@@ -16,6 +27,7 @@ constexpr std::size_t hardware_constructive_interference_size = 64;
 using KeyT = uint64_t;
 
 constexpr KeyT NULL_KEY = -1;
+static_assert(NULL_KEY == cuckoo::access_sampler::EMPTY);
 
 constexpr size_t NULL_SLOT_IDX = -1;
 constexpr size_t SLOTS_PER_BUCKET = 4;
@@ -52,6 +64,11 @@ struct alignas(hardware_constructive_interference_size / 2) Bucket {
   }
 
   iterator find_simd(const KeyT key) {
+#if defined(__ARM_FEATURE_SVE)
+    size_t i =
+        cuckoo::sve::find_first(key_slots.data(), SLOTS_PER_BUCKET, key);
+    return i < SLOTS_PER_BUCKET ? iterator(&key_slots[i]) : iterator();
+#else
     static_assert(SLOTS_PER_BUCKET == 4, "Only 4 slots supported");
 
     // Broadcast key and load 4 slots
@@ -68,22 +85,55 @@ struct alignas(hardware_constructive_interference_size / 2) Bucket {
     if (vgetq_lane_u64(eq1, 0)) return iterator(&key_slots[2]);
     if (vgetq_lane_u64(eq1, 1)) return iterator(&key_slots[3]);
     return iterator();
+#endif
+  }
+
+  // One bit per slot holding `key`, slot i at bit i.
+  uint32_t match_mask(const KeyT key) const {
+    static_assert(SLOTS_PER_BUCKET == 4, "Only 4 slots supported");
+
+    const uint64x2_t keys = vdupq_n_u64(key);
+    const uint64x2x2_t slots = vld1q_u64_x2(&key_slots[0]);
+
+    // Narrow the 64-bit lane masks to 32 bits and keep one bit of each
+    const uint32x4_t eq =
+        vcombine_u32(vmovn_u64(vceqq_u64(slots.val[0], keys)),
+                     vmovn_u64(vceqq_u64(slots.val[1], keys)));
+    const int32x4_t lane_shifts = {0, 1, 2, 3};
+    return vaddvq_u32(vshlq_u32(vshrq_n_u32(eq, 31), lane_shifts));
   }
 
   bool insert(KeyT key) {
-    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
-      if (is_empty(key_slots[i])) {
-        update(i, key);
-        return true;
-      } else if (key_slots[i] == key) {
-        throw std::runtime_error{"tried to insert existing key"};
-      }
+    if (match_mask(key)) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+    const uint32_t empty = match_mask(NULL_KEY);
+    if (!empty) {
+      return false;
+    }
+    update(__builtin_ctz(empty), key);
+    return true;
+  }
+
+  // Inserts into the first free slot of `b1`, or else of `b2`, after ruling
+  // out `key` in both. The duplicate and free-slot masks of the two buckets
+  // are built before anything is written. Returns false if both are full.
+  static bool insert_pair(Bucket& b1, Bucket& b2, KeyT key) {
+    if (b1.match_mask(key) | b2.match_mask(key)) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+    const uint32_t empty =
+        b1.match_mask(NULL_KEY) | (b2.match_mask(NULL_KEY) << SLOTS_PER_BUCKET);
+    if (!empty) {
+      return false;
     }
-    return false;
+    const size_t pos = __builtin_ctz(empty);
+    Bucket& bucket = pos < SLOTS_PER_BUCKET ? b1 : b2;
+    bucket.update(pos & (SLOTS_PER_BUCKET - 1), key);
+    return true;
   }
 
-  KeyT displace_insert(KeyT key) {
-    size_t disp_idx = get_random_displace_idx();
+  KeyT displace_insert(size_t disp_idx, KeyT key) {
     KeyT to_displace = key_slots[disp_idx];
     update(disp_idx, key);
     return to_displace;
@@ -97,14 +147,20 @@ struct alignas(hardware_constructive_interference_size / 2) Bucket {
     key_slots[i] = NULL_KEY;
   }
 
- private:
-  static size_t get_random_displace_idx() {
-    static size_t curr_idx{0};
-    curr_idx++;
-    return curr_idx & (SLOTS_PER_BUCKET - 1);
+  size_t find_empty() const {
+#if defined(__ARM_FEATURE_SVE)
+    size_t i =
+        cuckoo::sve::find_first(key_slots.data(), SLOTS_PER_BUCKET, NULL_KEY);
+    return i < SLOTS_PER_BUCKET ? i : NULL_SLOT_IDX;
+#else
+    const uint32_t empty = match_mask(NULL_KEY);
+    return empty ? static_cast<size_t>(__builtin_ctz(empty)) : NULL_SLOT_IDX;
+#endif
   }
 
-  static bool is_empty(const KeyT& key) { return key == NULL_KEY; }
+  size_t slot_idx(const iterator& it) const {
+    return static_cast<size_t>(it.slot_ - key_slots.data());
+  }
 };
 static_assert(alignof(Bucket) == hardware_constructive_interference_size / 2);
 static_assert(sizeof(Bucket) == hardware_constructive_interference_size / 2);
@@ -115,40 +171,174 @@ class cuckoo_set {
  public:
   using iterator = Bucket::iterator;
 
+  // Per-key bucket ids carried from prefetch_batched() to search_batched().
+  struct batch_state {
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+  };
+
   cuckoo_set(size_t capacity)
       : hash_fn_(),
         allocator_(),
-        num_buckets_(next_pow2(capacity) / SLOTS_PER_BUCKET),
+        num_buckets_(cuckoo::detail::next_pow2(capacity) / SLOTS_PER_BUCKET),
         bucket_bitmask_(num_buckets_ - 1),
         buckets_() {
     if ((num_buckets_ & (num_buckets_ - 1)) != 0) {
       throw std::invalid_argument("num_buckets must be a power of 2");
     }
 
-    buckets_ = allocator_.allocate(num_buckets_);
-    if ((uint64_t)(buckets_) % hardware_constructive_interference_size != 0) {
-      throw std::runtime_error("buckets_ is not cache-aligned");
-    }
+    allocate_buckets();
+    reset_buckets();
+  }
+
+  cuckoo_set(const cuckoo_set&) = delete;
+  cuckoo_set& operator=(const cuckoo_set&) = delete;
+
+  // Leaves `other` empty with the same capacity. Its bucket array is only
+  // allocated again by the first insert.
+  cuckoo_set(cuckoo_set&& other) noexcept
+      : hash_fn_(std::move(other.hash_fn_)),
+        allocator_(std::move(other.allocator_)),
+        num_buckets_(other.num_buckets_),
+        bucket_bitmask_(std::exchange(other.bucket_bitmask_, 0)),
+        buckets_(std::exchange(other.buckets_, unallocated())),
+        sz_(std::exchange(other.sz_, 0)),
+        sampler_(std::move(other.sampler_)) {
+    other.bump_write_epoch();
+  }
 
-    // initialize slots
-    for (size_t i = 0; i < num_buckets_ * SLOTS_PER_BUCKET; ++i) {
-      buckets_[i / SLOTS_PER_BUCKET].erase(i % SLOTS_PER_BUCKET);
+  cuckoo_set& operator=(cuckoo_set&& other) noexcept {
+    if (this != &other) {
+      cuckoo_set tmp(std::move(other));
+      swap(tmp);
     }
+    return *this;
   }
 
   ~cuckoo_set() {
-    if (buckets_) {
+    if (allocated()) {
       allocator_.deallocate(buckets_, num_buckets_);
     }
   }
 
+  // Moves the keys into the smallest power-of-two bucket array with a load
+  // factor of at most `max_load` and frees the old array. Sizes that fail to
+  // fit the keys are skipped; without a smaller fit the set is unchanged.
+  // Throws std::invalid_argument unless `max_load` is in (0, 1].
+  void shrink_to_fit(double max_load = DEFAULT_SHRINK_LOAD) {
+    // also rejects NaN
+    if (!(max_load > 0.0 && max_load <= 1.0)) {
+      throw std::invalid_argument("max_load must be in (0, 1]");
+    }
+    size_t capacity = cuckoo::detail::next_pow2(std::max<size_t>(
+        SLOTS_PER_BUCKET, static_cast<size_t>(sz_ / max_load)));
+    for (; allocated() && capacity < num_buckets_ * SLOTS_PER_BUCKET;
+         capacity *= 2) {
+      cuckoo_set shrunk(capacity);
+      try {
+        for_each([&](KeyT key) { shrunk.insert(key); });
+      } catch (const std::runtime_error&) {
+        continue;
+      }
+      shrunk.sampler_ = std::move(sampler_);
+      swap(shrunk);
+      return;
+    }
+  }
+
+  void swap(cuckoo_set& other) noexcept {
+    using std::swap;
+    swap(hash_fn_, other.hash_fn_);
+    swap(allocator_, other.allocator_);
+    swap(num_buckets_, other.num_buckets_);
+    swap(bucket_bitmask_, other.bucket_bitmask_);
+    swap(buckets_, other.buckets_);
+    swap(sz_, other.sz_);
+    swap(sampler_, other.sampler_);
+    bump_write_epoch();
+    other.bump_write_epoch();
+  }
+
+  cuckoo_set clone() {
+    cuckoo_set copy(*this, clone_tag{});
+    cuckoo::parallel_for(allocated() ? num_buckets_ : 0, PARALLEL_MIN_BUCKETS,
+                         [&](size_t begin, size_t end) {
+                           std::copy(buckets_ + begin, buckets_ + end,
+                                     copy.buckets_ + begin);
+                         });
+    return copy;
+  }
+
+  // Empties the set in place, the bucket array stays allocated and resident.
+  void clear() {
+    reset_buckets();
+    sz_ = 0;
+    bump_write_epoch();
+  }
+
   size_t size() { return sz_; }
 
+  // Bumped by every insert and erase, so that caches in front of the table
+  // (see front_cache) can tell when their iterators may have gone stale.
+  uint64_t write_epoch() const {
+    return write_epoch_.load(std::memory_order_acquire);
+  }
+
   double load_factor() {
     return static_cast<double>(sz_) / (num_buckets_ * SLOTS_PER_BUCKET);
   }
 
+  // Smallest capacity that keeps `n` keys at or below `target_load` once the
+  // constructor has rounded it to a power of two. Throws
+  // std::invalid_argument unless `target_load` is in (0, 1].
+  static constexpr size_t recommend_capacity(size_t n, double target_load) {
+    if (!(target_load > 0.0 && target_load <= 1.0)) {
+      throw std::invalid_argument("target_load must be in (0, 1]");
+    }
+    // past 2^63 slots the power of two does not fit in a size_t
+    if (!(n / target_load <= 0x1p63)) {
+      throw std::invalid_argument("n / target_load is too large");
+    }
+    size_t min_slots = static_cast<size_t>(n / target_load);
+    if (min_slots * target_load < n) {
+      min_slots++;
+    }
+    return cuckoo::detail::next_pow2(std::max(min_slots, SLOTS_PER_BUCKET));
+  }
+
+  cuckoo::memory_usage_info memory_usage() {
+    size_t bytes = allocated() ? num_buckets_ * sizeof(Bucket) : 0;
+    size_t page_size = cuckoo::detail::backing_page_size<Allocator>(bytes);
+    if (!allocated()) {
+      return {0, 0, page_size, 0, 0.0};
+    }
+    size_t bytes_allocated = cuckoo::detail::round_up(bytes, page_size);
+    return {
+        bytes_allocated,
+        cuckoo::detail::resident_bytes(buckets_, bytes),
+        page_size,
+        num_buckets_,
+        static_cast<double>(sz_ * sizeof(KeyT)) / bytes_allocated,
+    };
+  }
+
+  // Calls `fn(key)` for every key, in bucket order.
+  template <class Fn>
+  void for_each(Fn&& fn) {
+    for (size_t i = 0; allocated() && i < num_buckets_; ++i) {
+      for (const KeyT& key : buckets_[i].key_slots) {
+        if (key != NULL_KEY) {
+          fn(key);
+        }
+      }
+    }
+  }
+
   iterator find(KeyT key) {
+    if (sampler_.enabled()) {
+      sampler_.record(key);
+    }
+
     size_t hash = hash_key(key);
     size_t bucket_id1 = get_bucket_id(hash);
 
@@ -162,67 +352,269 @@ class cuckoo_set {
   }
 
   void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
-    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
-    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+    batch_state state;
+    prefetch_batched(keys, num_keys, state);
+    search_batched(keys, num_keys, state, results);
+  }
 
-    // Compute hashes and prefetch buckets
-    for (size_t i = 0; i < num_keys; ++i) {
-      bucket_id2s[i] = hash_key(keys[i]);
-      bucket_id1s[i] = get_bucket_id(bucket_id2s[i]);
-      __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
-    }
+  // find_batched() split in two for probe_many(). Only the first buckets are
+  // prefetched up front, search_batched() fetches second buckets for misses.
+  // Both take at most MAX_LOOKUP_BATCH_SZ keys, as batch_state holds.
+  void prefetch_batched(const KeyT* keys, size_t num_keys,
+                        batch_state& state) {
+    prefetch_batched_impl([keys](size_t i) { return keys[i]; }, num_keys,
+                          state);
+  }
 
+  void search_batched(const KeyT* keys, size_t num_keys, batch_state& state,
+                      iterator* results) {
     // Search buckets via SIMD
     for (size_t i = 0; i < num_keys; ++i) {
-      results[i] = buckets_[bucket_id1s[i]].find_simd(keys[i]);
+      if (sampler_.enabled()) {
+        sampler_.record(keys[i]);
+      }
+      results[i] = buckets_[state.bucket_id1s[i]].find_simd(keys[i]);
     }
 
     // Search second bucket for any misses
     for (size_t i = 0; i < num_keys; ++i) {
       if (!results[i].is_null()) continue;
-      bucket_id2s[i] = get_other_bucket_id(bucket_id2s[i], keys[i]);
-      __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
+      state.bucket_id2s[i] = get_other_bucket_id(state.bucket_id2s[i], keys[i]);
+      __builtin_prefetch(&buckets_[state.bucket_id2s[i]], 0, 3);
     }
     for (size_t i = 0; i < num_keys; ++i) {
       if (!results[i].is_null()) continue;
-      results[i] = buckets_[bucket_id2s[i]].find_simd(keys[i]);
+      results[i] = buckets_[state.bucket_id2s[i]].find_simd(keys[i]);
     }
   }
 
+  // As find_batched(), for any number of keys, with the i-th key read from
+  // `base + i * stride + offset`.
+  void find_batched_strided(const void* base, size_t stride, size_t offset,
+                            size_t num_keys, iterator* results) {
+    const auto* bytes = static_cast<const uint8_t*>(base) + offset;
+    find_batched_impl(
+        [bytes, stride](size_t i) {
+          KeyT key;
+          std::memcpy(&key, bytes + i * stride, sizeof(KeyT));
+          return key;
+        },
+        num_keys, results);
+  }
+
+  // As find_batched(), for any number of keys, with the i-th key being
+  // `keys[idxs[i]]`.
+  void find_batched_gather(const KeyT* keys, const size_t* idxs,
+                           size_t num_keys, iterator* results) {
+    find_batched_impl([keys, idxs](size_t i) { return keys[idxs[i]]; },
+                      num_keys, results);
+  }
+
   void erase(const iterator& it) {
     sz_--;
+    bump_write_epoch();
     *it.slot_ = NULL_KEY;
   }
 
+  // Throws std::invalid_argument for NULL_KEY, which marks empty slots.
   void insert(KeyT key) {
-    sz_++;
-
+    if (key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+    ensure_allocated();
     size_t hash = hash_key(key);
     size_t bucket_id1 = get_bucket_id(hash);
     size_t bucket_id2 = get_other_bucket_id(hash, key);
 
-    Bucket& bucket1 = buckets_[bucket_id1];
-    if (bucket1.insert(key)) {
-      return;
+    // Throws on a duplicate before the buckets are touched
+    bool inserted =
+        Bucket::insert_pair(buckets_[bucket_id1], buckets_[bucket_id2], key);
+    bump_write_epoch();
+    if (!inserted) {
+      displace_insert(bucket_id1, key, 0);
     }
+    sz_++;
+  }
 
-    Bucket& bucket2 = buckets_[bucket_id2];
-    if (bucket2.insert(key)) {
-      return;
+  // Samples roughly one in `period` looked up keys for rebalance(), see
+  // access_sampler. 0 disables sampling and frees the samples. Only change it
+  // while the set is idle.
+  void set_access_sampling(size_t period) { sampler_.set_period(period); }
+
+  // Moves the hottest sampled keys to slot 0 of their first bucket, where both
+  // find() and the first pass of find_batched() look. A key in its second
+  // bucket only moves if that needs no displacement chain. Returns the number
+  // of keys moved; the caller must make sure nothing else uses the set
+  // meanwhile.
+  size_t rebalance(size_t max_moves = cuckoo::access_sampler::SAMPLE_SZ) {
+    std::vector<KeyT> hottest = sampler_.take_hottest();
+    size_t num_moved = 0;
+    for (size_t i = 0; i < hottest.size() && num_moved < max_moves; ++i) {
+      num_moved += promote(hottest[i]);
     }
-
-    return displace_insert(bucket_id1, key, 0);
+    if (num_moved) {
+      bump_write_epoch();
+    }
+    return num_moved;
   }
 
  private:
   static constexpr size_t MAX_INSERT_DEPTH = 256;
+  static constexpr double DEFAULT_SHRINK_LOAD = 0.5;
+  static constexpr size_t PARALLEL_MIN_BUCKETS =
+      cuckoo::detail::parallel_min_buckets<Bucket>();
+
+  struct clone_tag {};
+
+  cuckoo_set(const cuckoo_set& other, clone_tag)
+      : hash_fn_(other.hash_fn_),
+        allocator_(other.allocator_),
+        num_buckets_(other.num_buckets_),
+        bucket_bitmask_(other.bucket_bitmask_),
+        buckets_(),
+        sz_(other.sz_),
+        sampler_(other.sampler_.clone()) {
+    if (other.allocated()) {
+      allocate_buckets();
+    } else {
+      buckets_ = unallocated();
+    }
+  }
+
+  void allocate_buckets() {
+    Bucket* buckets = allocator_.allocate(num_buckets_);
+    if ((uint64_t)(buckets) % hardware_constructive_interference_size != 0) {
+      allocator_.deallocate(buckets, num_buckets_);
+      throw std::runtime_error("buckets_ is not cache-aligned");
+    }
+    buckets_ = buckets;
+  }
+
+  // Gives a moved-from set a bucket array again.
+  void ensure_allocated() {
+    if (!allocated()) {
+      allocate_buckets();
+      reset_buckets();
+      bucket_bitmask_ = num_buckets_ - 1;
+    }
+  }
+
+  bool allocated() const { return buckets_ != unallocated(); }
+
+  // The bucket array of a moved-from set: with a bitmask of 0 every key maps
+  // to this one empty bucket, so lookups need no check.
+  static Bucket* unallocated() {
+    static Bucket bucket = empty_bucket();
+    return &bucket;
+  }
+
+  static Bucket empty_bucket() {
+    Bucket empty;
+    empty.key_slots.fill(NULL_KEY);
+    return empty;
+  }
+
+  void reset_buckets() {
+    if (!allocated()) {
+      return;
+    }
+    Bucket empty = empty_bucket();
+    cuckoo::parallel_for(num_buckets_, PARALLEL_MIN_BUCKETS,
+                         [&](size_t begin, size_t end) {
+                           std::fill(buckets_ + begin, buckets_ + end, empty);
+                         });
+  }
+
+  bool promote(KeyT key) {
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    Bucket& primary = buckets_[bucket_id1];
+
+    auto it = primary.find_simd(key);
+    if (!it.is_null()) {
+      size_t idx = primary.slot_idx(it);
+      if (idx == 0) {
+        return false;
+      }
+      std::swap(primary.key_slots[0], primary.key_slots[idx]);
+      return true;
+    }
+
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+    it = buckets_[bucket_id2].find_simd(key);
+    if (it.is_null()) {
+      return false;
+    }
+
+    // Make room in the first bucket without a displacement chain
+    size_t idx = primary.find_empty();
+    for (size_t i = 0; i < SLOTS_PER_BUCKET && idx == NULL_SLOT_IDX; ++i) {
+      KeyT victim = primary.key_slots[i];
+      size_t victim_hash = hash_key(victim);
+      size_t victim_id1 = get_bucket_id(victim_hash);
+      size_t victim_id2 = get_other_bucket_id(victim_hash, victim);
+      size_t alt_id = victim_id1 == bucket_id1 ? victim_id2 : victim_id1;
+      if (alt_id == bucket_id1) {
+        continue;
+      }
+
+      if (alt_id == bucket_id2) {
+        std::swap(primary.key_slots[i], *it.slot_);
+        std::swap(primary.key_slots[0], primary.key_slots[i]);
+        return true;
+      }
+
+      size_t alt_idx = buckets_[alt_id].find_empty();
+      if (alt_idx != NULL_SLOT_IDX) {
+        buckets_[alt_id].update(alt_idx, victim);
+        idx = i;
+      }
+    }
+    if (idx == NULL_SLOT_IDX) {
+      return false;
+    }
+
+    primary.update(idx, key);
+    *it.slot_ = NULL_KEY;
+    std::swap(primary.key_slots[0], primary.key_slots[idx]);
+    return true;
+  }
+
+  // Each key is loaded once, while its buckets are being hashed, and the
+  // searches read it back from a local copy, MAX_LOOKUP_BATCH_SZ keys at a
+  // time.
+  template <class KeyLoader>
+  void find_batched_impl(KeyLoader load_key, size_t num_keys,
+                         iterator* results) {
+    std::array<KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+    batch_state state;
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(num_keys - base, MAX_LOOKUP_BATCH_SZ);
+      prefetch_batched_impl(
+          [&](size_t i) { return keys[i] = load_key(base + i); }, batch_sz,
+          state);
+      search_batched(keys.data(), batch_sz, state, results + base);
+    }
+  }
+
+  template <class KeyLoader>
+  void prefetch_batched_impl(KeyLoader load_key, size_t num_keys,
+                             batch_state& state) {
+    // Compute hashes and prefetch buckets
+    for (size_t i = 0; i < num_keys; ++i) {
+      state.bucket_id2s[i] = hash_key(load_key(i));
+      state.bucket_id1s[i] = get_bucket_id(state.bucket_id2s[i]);
+      __builtin_prefetch(&buckets_[state.bucket_id1s[i]], 0, 3);
+    }
+  }
 
   void displace_insert(size_t bucket_id, KeyT key, size_t curr_depth) {
     if (curr_depth >= MAX_INSERT_DEPTH) {
       throw std::runtime_error{"cannot find insertion slot."};
     }
 
-    KeyT displaced_slot = buckets_[bucket_id].displace_insert(key);
+    KeyT displaced_slot =
+        buckets_[bucket_id].displace_insert(next_displace_idx(), key);
 
     size_t hash = hash_key(displaced_slot);
     size_t bucket_id1 = get_bucket_id(hash);
@@ -236,22 +628,22 @@ class cuckoo_set {
     return displace_insert(nxt_bucket_id, displaced_slot, curr_depth + 1);
   }
 
-  static constexpr uint64_t next_pow2(uint64_t x) {
-    x--;
-    x |= (x >> 1);
-    x |= (x >> 2);
-    x |= (x >> 4);
-    x |= (x >> 8);
-    x |= (x >> 16);
-    x |= (x >> 32);
-    x++;
-    return x;
+  // writers are not concurrent with each other, so no RMW is needed
+  void bump_write_epoch() {
+    write_epoch_.store(write_epoch_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+  }
+
+  size_t next_displace_idx() {
+    return (displace_rng_() >> 32) & (SLOTS_PER_BUCKET - 1);
   }
 
   size_t hash_key(KeyT key) { return hash_fn_(key); }
-  size_t get_bucket_id(size_t h) { return h & bucket_bitmask_; }
+  size_t get_bucket_id(size_t h) {
+    return cuckoo::detail::primary_bucket_id(h, bucket_bitmask_);
+  }
   size_t get_other_bucket_id(size_t h, KeyT k) {
-    return hash_fn_(h ^ k) & bucket_bitmask_;
+    return cuckoo::detail::alternate_bucket_id(hash_fn_, h, k, bucket_bitmask_);
   }
 
   Hash hash_fn_;
@@ -262,6 +654,10 @@ class cuckoo_set {
   Bucket* buckets_;
 
   size_t sz_{0};
+  std::atomic<uint64_t> write_epoch_{0};
+  cuckoo::xorshift64 displace_rng_;
+
+  cuckoo::access_sampler sampler_;
 };
 
 }  // namespace cuckoo_set
@@ -1,13 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include <arm_neon.h>
 
+#include "access_sampler.hpp"
+#include "memory_usage.hpp"
+#include "parallel.hpp"
+#include "sve.hpp"
+#include "table_util.hpp"
+#include "xorshift.hpp"
+
 namespace cuckoo {
 
 // assume cache line size is 64B
@@ -21,6 +33,7 @@ using KvT = std::pair<KeyT, ValueT>;
 
 constexpr KeyT NULL_KEY = -1;
 constexpr ValueT NULL_VALUE = -1;
+static_assert(NULL_KEY == access_sampler::EMPTY);
 
 constexpr size_t NULL_SLOT_IDX = -1;
 constexpr size_t SLOTS_PER_BUCKET = 4;
@@ -64,6 +77,39 @@ struct alignas(hardware_constructive_interference_size) Bucket {
   }
 
   iterator find_simd(KeyT key) {
+#if defined(__ARM_FEATURE_SVE)
+    size_t i = sve::find_first(key_slots.data(), SLOTS_PER_BUCKET, key);
+    return i < SLOTS_PER_BUCKET ? iterator{this, i} : iterator{};
+#else
+    uint32_t mask = match_mask(key);
+    return mask
+      ? iterator{this, static_cast<size_t>(__builtin_ctz(mask))}
+      : iterator{};
+#endif
+  }
+
+  // Searches both candidate buckets of a key at once, for when both lines are
+  // already in cache. The 8 compares are packed into one mask and the match
+  // is selected with conditional moves, so a hit in either bucket and a miss
+  // take the same path. Slots of `b1` win if the two are the same bucket.
+  static iterator find_pair_simd(Bucket& b1, Bucket& b2, KeyT key) {
+#if defined(__ARM_FEATURE_SVE)
+    // vectors narrower than a bucket, e.g. 128-bit SVE, take the NEON path
+    size_t pos = svcntd() >= SLOTS_PER_BUCKET
+                     ? sve::find_first_pair<SLOTS_PER_BUCKET>(
+                           b1.key_slots.data(), b2.key_slots.data(), key)
+                     : match_pos_pair(b1, b2, key);
+#else
+    size_t pos = match_pos_pair(b1, b2, key);
+#endif
+    Bucket* bucket = pos < SLOTS_PER_BUCKET ? &b1 : &b2;
+    bool hit = pos < 2 * SLOTS_PER_BUCKET;
+    return iterator{hit ? bucket : nullptr,
+                    hit ? pos & (SLOTS_PER_BUCKET - 1) : NULL_SLOT_IDX};
+  }
+
+  // Bit i is set if slot i holds `key`.
+  uint32_t match_mask(KeyT key) const {
     static_assert(SLOTS_PER_BUCKET == 4, "Only 4 slots supported");
 
     uint64x2_t key_vec = vdupq_n_u64(key);
@@ -78,27 +124,66 @@ struct alignas(hardware_constructive_interference_size) Bucket {
     uint32x4_t m_all = vshrq_n_u32(cmp_all, 31);
     const int32x4_t shift_weights = {0, 1, 2, 3};
     uint32x4_t m_all_weighted = vshlq_u32(m_all, shift_weights);
-    uint32_t mask = vaddvq_u32(m_all_weighted);
+    return vaddvq_u32(m_all_weighted);
+  }
 
-    return mask
-      ? iterator{this, static_cast<size_t>(__builtin_ctz(mask))}
-      : iterator{};
+  // Bit i is set if slot i of `b1` holds `key`, bit 4 + i if slot i of `b2`
+  // does.
+  static uint32_t match_mask_pair(const Bucket& b1, const Bucket& b2,
+                                  KeyT key) {
+    static_assert(SLOTS_PER_BUCKET == 4, "Only 4 slots supported");
+
+    uint64x2_t key_vec = vdupq_n_u64(key);
+
+    uint32x4_t cmp1 = vcombine_u32(
+        vmovn_u64(vceqq_u64(vld1q_u64(&b1.key_slots[0]), key_vec)),
+        vmovn_u64(vceqq_u64(vld1q_u64(&b1.key_slots[2]), key_vec)));
+    uint32x4_t cmp2 = vcombine_u32(
+        vmovn_u64(vceqq_u64(vld1q_u64(&b2.key_slots[0]), key_vec)),
+        vmovn_u64(vceqq_u64(vld1q_u64(&b2.key_slots[2]), key_vec)));
+    uint16x8_t cmp_all = vcombine_u16(vmovn_u32(cmp1), vmovn_u32(cmp2));
+
+    const uint16x8_t bit_weights = {1, 2, 4, 8, 16, 32, 64, 128};
+    return vaddvq_u16(vandq_u16(cmp_all, bit_weights));
+  }
+
+  // Position of the first match in the mask of match_mask_pair(), 8 on a
+  // miss.
+  static size_t match_pos_pair(const Bucket& b1, const Bucket& b2, KeyT key) {
+    uint32_t mask = match_mask_pair(b1, b2, key);
+    return __builtin_ctz(mask | (1u << (2 * SLOTS_PER_BUCKET)));
   }
 
   bool insert(KeyT key, ValueT value) {
-    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
-      if (is_empty(key_slots[i])) {
-        update(i, key, value);
-        return true;
-      } else if (key_slots[i] == key) {
-        throw std::runtime_error{"tried to insert existing key"};
-      }
+    if (match_mask(key)) {
+      throw std::runtime_error{"tried to insert existing key"};
     }
-    return false;
+    uint32_t empty = match_mask(NULL_KEY);
+    if (!empty) {
+      return false;
+    }
+    update(__builtin_ctz(empty), key, value);
+    return true;
+  }
+
+  // Checks both candidate buckets for `key` and finds the first empty slot of
+  // either in one pass over the two lines, then fills that slot. Returns false
+  // if both buckets are full.
+  static bool insert_pair(Bucket& b1, Bucket& b2, KeyT key, ValueT value) {
+    if (match_mask_pair(b1, b2, key)) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+    uint32_t empty = match_mask_pair(b1, b2, NULL_KEY);
+    if (!empty) {
+      return false;
+    }
+    size_t pos = __builtin_ctz(empty);
+    Bucket& bucket = pos < SLOTS_PER_BUCKET ? b1 : b2;
+    bucket.update(pos & (SLOTS_PER_BUCKET - 1), key, value);
+    return true;
   }
 
-  KvT displace_insert(KeyT key, ValueT value) {
-    size_t disp_idx = get_random_displace_idx();
+  KvT displace_insert(size_t disp_idx, KeyT key, ValueT value) {
     KvT to_displace = {key_slots[disp_idx], value_slots[disp_idx]};
     update(disp_idx, key, value);
     return to_displace;
@@ -114,14 +199,20 @@ struct alignas(hardware_constructive_interference_size) Bucket {
     value_slots[i] = NULL_VALUE;
   }
 
- private:
-  static size_t get_random_displace_idx() {
-    static size_t curr_idx{0};
-    curr_idx++;
-    return curr_idx & (SLOTS_PER_BUCKET - 1);
+  size_t find_empty() const {
+#if defined(__ARM_FEATURE_SVE)
+    size_t i = sve::find_first(key_slots.data(), SLOTS_PER_BUCKET, NULL_KEY);
+    return i < SLOTS_PER_BUCKET ? i : NULL_SLOT_IDX;
+#else
+    uint32_t empty = match_mask(NULL_KEY);
+    return empty ? static_cast<size_t>(__builtin_ctz(empty)) : NULL_SLOT_IDX;
+#endif
   }
 
-  static bool is_empty(const KeyT& key) { return key == NULL_KEY; }
+  void swap_slots(size_t i, size_t j) {
+    std::swap(key_slots[i], key_slots[j]);
+    std::swap(value_slots[i], value_slots[j]);
+  }
 };
 static_assert(alignof(Bucket) == hardware_constructive_interference_size);
 static_assert(sizeof(Bucket) == hardware_constructive_interference_size);
@@ -132,40 +223,202 @@ class cuckoo_table {
  public:
   using iterator = Bucket::iterator;
 
-  cuckoo_table(size_t capacity)
+  // Per-key bucket ids carried from prefetch_batched() to search_batched().
+  struct batch_state {
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+  };
+
+  // A single request of a mixed batch, see execute_batch().
+  struct Op {
+    enum class Type : uint8_t { find, insert, upsert, erase };
+
+    Type type;
+    KeyT key;
+    ValueT value{NULL_VALUE};
+
+    // result slots, filled in by execute_batch()
+    // found: whether the key was present when the op was applied
+    // result: the matching slot for find ops
+    bool found{false};
+    iterator result{};
+  };
+
+  // Stateful allocators, such as numa_allocator, can be passed in to place
+  // the bucket array.
+  cuckoo_table(size_t capacity, const Allocator& allocator = Allocator())
       : hash_fn_(),
-        allocator_(),
-        num_buckets_(next_pow2(capacity) / SLOTS_PER_BUCKET),
+        allocator_(allocator),
+        num_buckets_(detail::next_pow2(capacity) / SLOTS_PER_BUCKET),
         bucket_bitmask_(num_buckets_ - 1),
         buckets_() {
     if ((num_buckets_ & (num_buckets_ - 1)) != 0) {
       throw std::invalid_argument("num_buckets must be a power of 2");
     }
 
-    buckets_ = allocator_.allocate(num_buckets_);
-    if ((uint64_t)(buckets_) % hardware_constructive_interference_size != 0) {
-      throw std::runtime_error("buckets_ is not cache-aligned");
-    }
+    allocate_buckets();
+    reset_buckets();
+  }
 
-    // initialize slots
-    for (size_t i = 0; i < num_buckets_ * SLOTS_PER_BUCKET; ++i) {
-      buckets_[i / SLOTS_PER_BUCKET].erase(i % SLOTS_PER_BUCKET);
+  // Copying is explicit through clone().
+  cuckoo_table(const cuckoo_table&) = delete;
+  cuckoo_table& operator=(const cuckoo_table&) = delete;
+
+  // A moved-from table is empty and keeps its capacity. Its bucket array is
+  // only allocated again by the first write.
+  cuckoo_table(cuckoo_table&& other) noexcept
+      : hash_fn_(std::move(other.hash_fn_)),
+        allocator_(std::move(other.allocator_)),
+        num_buckets_(other.num_buckets_),
+        bucket_bitmask_(std::exchange(other.bucket_bitmask_, 0)),
+        buckets_(std::exchange(other.buckets_, unallocated())),
+        sz_(std::exchange(other.sz_, 0)),
+        sampler_(std::move(other.sampler_)) {
+    other.bump_write_epoch();
+  }
+
+  cuckoo_table& operator=(cuckoo_table&& other) noexcept {
+    if (this != &other) {
+      cuckoo_table tmp(std::move(other));
+      swap(tmp);
     }
+    return *this;
   }
 
   ~cuckoo_table() {
-    if (buckets_) {
+    if (allocated()) {
       allocator_.deallocate(buckets_, num_buckets_);
     }
   }
 
+  // Rehashes into the smallest power-of-two bucket array that keeps the load
+  // factor at or below `max_load`, and frees the old one, e.g. after a bulk
+  // erase. If the entries do not fit a size, the next larger one is tried, and
+  // the table is left as is if none smaller than the current one works.
+  // Invalidates iterators. Throws std::invalid_argument unless `max_load` is
+  // in (0, 1].
+  void shrink_to_fit(double max_load = DEFAULT_SHRINK_LOAD) {
+    // also rejects NaN
+    if (!(max_load > 0.0 && max_load <= 1.0)) {
+      throw std::invalid_argument("max_load must be in (0, 1]");
+    }
+    size_t capacity = detail::next_pow2(std::max<size_t>(
+        SLOTS_PER_BUCKET, static_cast<size_t>(sz_ / max_load)));
+    for (; allocated() && capacity < num_buckets_ * SLOTS_PER_BUCKET;
+         capacity *= 2) {
+      cuckoo_table shrunk(capacity, allocator_);
+      try {
+        for_each([&](KeyT key, ValueT value) { shrunk.insert(key, value); });
+      } catch (const std::runtime_error&) {
+        continue;
+      }
+      shrunk.sampler_ = std::move(sampler_);
+      swap(shrunk);
+      return;
+    }
+  }
+
+  void swap(cuckoo_table& other) noexcept {
+    using std::swap;
+    swap(hash_fn_, other.hash_fn_);
+    swap(allocator_, other.allocator_);
+    swap(num_buckets_, other.num_buckets_);
+    swap(bucket_bitmask_, other.bucket_bitmask_);
+    swap(buckets_, other.buckets_);
+    swap(sz_, other.sz_);
+    swap(sampler_, other.sampler_);
+    bump_write_epoch();
+    other.bump_write_epoch();
+  }
+
+  // Returns a copy of the table. The bucket array is copied in parallel.
+  cuckoo_table clone() { return clone(allocator_); }
+
+  // As clone(), with the copy's bucket array taken from `allocator`, e.g. to
+  // place a replica on another NUMA node.
+  cuckoo_table clone(const Allocator& allocator) {
+    cuckoo_table copy(*this, allocator, clone_tag{});
+    parallel_for(allocated() ? num_buckets_ : 0, PARALLEL_MIN_BUCKETS,
+                 [&](size_t begin, size_t end) {
+                   std::copy(buckets_ + begin, buckets_ + end,
+                             copy.buckets_ + begin);
+                 });
+    return copy;
+  }
+
+  // Erases every entry but keeps the bucket array, so that reusing the table
+  // does not fault its pages in again.
+  void clear() {
+    reset_buckets();
+    sz_ = 0;
+    bump_write_epoch();
+  }
+
   size_t size() { return sz_; }
 
+  // Bumped by every insert and erase, so that caches in front of the table
+  // (see front_cache) can tell when their iterators may have gone stale.
+  uint64_t write_epoch() const {
+    return write_epoch_.load(std::memory_order_acquire);
+  }
+
   double load_factor() {
     return static_cast<double>(sz_) / (num_buckets_ * SLOTS_PER_BUCKET);
   }
 
+  // Capacity to construct a table with so that `n` entries load it to at most
+  // `target_load`. The result is already a power of two, so the constructor
+  // will not round it up any further. Throws std::invalid_argument unless
+  // `target_load` is in (0, 1].
+  static constexpr size_t recommend_capacity(size_t n, double target_load) {
+    if (!(target_load > 0.0 && target_load <= 1.0)) {
+      throw std::invalid_argument("target_load must be in (0, 1]");
+    }
+    // past 2^63 slots the power of two does not fit in a size_t
+    if (!(n / target_load <= 0x1p63)) {
+      throw std::invalid_argument("n / target_load is too large");
+    }
+    size_t min_slots = static_cast<size_t>(n / target_load);
+    if (min_slots * target_load < n) {
+      min_slots++;
+    }
+    return detail::next_pow2(std::max(min_slots, SLOTS_PER_BUCKET));
+  }
+
+  // Reports the bucket array's footprint, with residency taken from mincore().
+  memory_usage_info memory_usage() {
+    size_t bytes = allocated() ? num_buckets_ * sizeof(Bucket) : 0;
+    size_t page_size = detail::backing_page_size<Allocator>(bytes);
+    if (!allocated()) {
+      return {0, 0, page_size, 0, 0.0};
+    }
+    size_t bytes_allocated = detail::round_up(bytes, page_size);
+    return {
+        bytes_allocated,
+        detail::resident_bytes(buckets_, bytes),
+        page_size,
+        num_buckets_,
+        static_cast<double>(sz_ * (sizeof(KeyT) + sizeof(ValueT))) / bytes_allocated,
+    };
+  }
+
+  // Calls `fn(key, value)` for every entry, in bucket order.
+  template <class Fn>
+  void for_each(Fn&& fn) {
+    for (size_t i = 0; allocated() && i < num_buckets_; ++i) {
+      for (size_t j = 0; j < SLOTS_PER_BUCKET; ++j) {
+        if (buckets_[i].key_slots[j] != NULL_KEY) {
+          fn(buckets_[i].key_slots[j], buckets_[i].value_slots[j]);
+        }
+      }
+    }
+  }
+
   iterator find(KeyT key) {
+    if (sampler_.enabled()) {
+      sampler_.record(key);
+    }
+
     size_t hash = hash_key(key);
     size_t bucket_id1 = get_bucket_id(hash);
 
@@ -179,61 +432,417 @@ class cuckoo_table {
   }
 
   void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
-    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
-    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+    batch_state state;
+    prefetch_batched(keys, num_keys, state);
+    search_batched(keys, num_keys, state, results);
+  }
 
-    // compute hashes and prefetch buckets
-    for (size_t i = 0; i < num_keys; ++i) {
-      size_t hash = hash_key(keys[i]);
-      bucket_id1s[i] = get_bucket_id(hash);
-      bucket_id2s[i] = get_other_bucket_id(hash, keys[i]);
-      __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
-      __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
-    }
+  // The two halves of find_batched(), exposed so that the prefetches for
+  // several tables can all be issued before any of them is searched. See
+  // probe_many(). Both take at most MAX_LOOKUP_BATCH_SZ keys, the size of
+  // batch_state.
+  void prefetch_batched(const KeyT* keys, size_t num_keys,
+                        batch_state& state) {
+    prefetch_batched_impl([keys](size_t i) { return keys[i]; }, num_keys,
+                          state);
+  }
 
+  void search_batched(const KeyT* keys, size_t num_keys, batch_state& state,
+                      iterator* results) {
     // search buckets via SIMD
     for (size_t i = 0; i < num_keys; ++i) {
-      results[i] = buckets_[bucket_id1s[i]].find_simd(keys[i]);
-      if (results[i].is_null()) {
-        results[i] = buckets_[bucket_id2s[i]].find_simd(keys[i]);
+      results[i] = find_in_buckets(keys[i], state.bucket_id1s[i],
+                                   state.bucket_id2s[i]);
+    }
+  }
+
+  // Looks up any number of keys embedded in an array of structs, where the
+  // i-th key is read from `base + i * stride + offset`, without copying them
+  // out first.
+  void find_batched_strided(const void* base, size_t stride, size_t offset,
+                            size_t num_keys, iterator* results) {
+    const auto* bytes = static_cast<const uint8_t*>(base) + offset;
+    find_batched_impl(
+        [bytes, stride](size_t i) {
+          KeyT key;
+          std::memcpy(&key, bytes + i * stride, sizeof(KeyT));
+          return key;
+        },
+        num_keys, results);
+  }
+
+  // Looks up `keys[idxs[i]]` for any number of i. NEON has no gather load, so
+  // each key is loaded individually while its buckets are being hashed.
+  void find_batched_gather(const KeyT* keys, const size_t* idxs,
+                           size_t num_keys, iterator* results) {
+    find_batched_impl([keys, idxs](size_t i) { return keys[idxs[i]]; },
+                      num_keys, results);
+  }
+
+  // Looks up any number of keys whose values are addresses of larger records
+  // and calls `fn(i, it)` for the i-th key. Keys go through a three-stage
+  // pipeline a batch at a time: while one batch's buckets are prefetched, the
+  // previous batch is searched and the records of its hits are prefetched,
+  // and the batch before that is handed to `fn`. A record miss thus overlaps
+  // with the bucket misses of the following keys instead of serializing.
+  template <class Fn>
+  void find_batched_deref(const KeyT* keys, size_t num_keys, Fn&& fn) {
+    static_assert(sizeof(ValueT) >= sizeof(uintptr_t),
+                  "values must be able to hold an address");
+
+    constexpr size_t NUM_STAGES = 3;
+    std::array<std::array<size_t, MAX_LOOKUP_BATCH_SZ>, NUM_STAGES> bucket_id1s;
+    std::array<std::array<size_t, MAX_LOOKUP_BATCH_SZ>, NUM_STAGES> bucket_id2s;
+    std::array<std::array<iterator, MAX_LOOKUP_BATCH_SZ>, NUM_STAGES> results;
+
+    const size_t num_batches =
+        (num_keys + MAX_LOOKUP_BATCH_SZ - 1) / MAX_LOOKUP_BATCH_SZ;
+    auto batch_sz = [num_keys](size_t batch) {
+      return std::min(num_keys - batch * MAX_LOOKUP_BATCH_SZ,
+                      MAX_LOOKUP_BATCH_SZ);
+    };
+
+    for (size_t step = 0; step < num_batches + NUM_STAGES - 1; ++step) {
+      // compute hashes and prefetch buckets
+      if (step < num_batches) {
+        const KeyT* batch_keys = keys + step * MAX_LOOKUP_BATCH_SZ;
+        auto& ids1 = bucket_id1s[step % NUM_STAGES];
+        auto& ids2 = bucket_id2s[step % NUM_STAGES];
+        for (size_t i = 0; i < batch_sz(step); ++i) {
+          size_t hash = hash_key(batch_keys[i]);
+          ids1[i] = get_bucket_id(hash);
+          ids2[i] = get_other_bucket_id(hash, batch_keys[i]);
+          __builtin_prefetch(&buckets_[ids1[i]], 0, 3);
+          __builtin_prefetch(&buckets_[ids2[i]], 0, 3);
+        }
+      }
+
+      // search buckets via SIMD and prefetch the records of hits
+      if (step >= 1 && step - 1 < num_batches) {
+        size_t batch = step - 1;
+        const KeyT* batch_keys = keys + batch * MAX_LOOKUP_BATCH_SZ;
+        auto& batch_results = results[batch % NUM_STAGES];
+        for (size_t i = 0; i < batch_sz(batch); ++i) {
+          batch_results[i] =
+              find_in_buckets(batch_keys[i], bucket_id1s[batch % NUM_STAGES][i],
+                              bucket_id2s[batch % NUM_STAGES][i]);
+          if (!batch_results[i].is_null()) {
+            __builtin_prefetch(
+                reinterpret_cast<const void*>(batch_results[i].value()), 0, 3);
+          }
+        }
+      }
+
+      // hand results to the caller
+      if (step >= 2) {
+        size_t batch = step - 2;
+        auto& batch_results = results[batch % NUM_STAGES];
+        for (size_t i = 0; i < batch_sz(batch); ++i) {
+          fn(batch * MAX_LOOKUP_BATCH_SZ + i, batch_results[i]);
+        }
+      }
+    }
+  }
+
+  // Applies a pipeline of mixed ops. Buckets are hashed and prefetched a
+  // batch at a time, then the ops are applied in order so that ops on the
+  // same key observe each other. Inserting an existing key leaves the table
+  // untouched and sets `found`. As with insert(), iterators returned by
+  // earlier find ops may be invalidated by later inserts and upserts. An op
+  // other than find on NULL_KEY throws std::invalid_argument, leaving the ops
+  // before it applied.
+  void execute_batch(Op* ops, size_t num_ops) {
+    if (num_ops) {
+      ensure_allocated();
+    }
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+
+    for (size_t start = 0; start < num_ops; start += MAX_LOOKUP_BATCH_SZ) {
+      Op* batch = ops + start;
+      size_t batch_sz = std::min(num_ops - start, MAX_LOOKUP_BATCH_SZ);
+
+      // compute hashes and prefetch buckets, for writing if the op may mutate
+      for (size_t i = 0; i < batch_sz; ++i) {
+        size_t hash = hash_key(batch[i].key);
+        bucket_id1s[i] = get_bucket_id(hash);
+        bucket_id2s[i] = get_other_bucket_id(hash, batch[i].key);
+        if (batch[i].type == Op::Type::find) {
+          __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
+          __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
+        } else {
+          __builtin_prefetch(&buckets_[bucket_id1s[i]], 1, 3);
+          __builtin_prefetch(&buckets_[bucket_id2s[i]], 1, 3);
+        }
+      }
+
+      // apply ops in order
+      for (size_t i = 0; i < batch_sz; ++i) {
+        apply_op(batch[i], bucket_id1s[i], bucket_id2s[i]);
       }
     }
   }
 
   void erase(const iterator& it) {
     sz_--;
+    bump_write_epoch();
     it.bucket_->erase(it.slot_idx_);
   }
 
+  // Throws std::invalid_argument for NULL_KEY, which marks empty slots.
   void insert(KeyT key, ValueT value) {
-    sz_++;
+    check_key(key);
+    ensure_allocated();
+    size_t hash = hash_key(key);
+    insert_into(get_bucket_id(hash), get_other_bucket_id(hash, key), key,
+                value);
+  }
+
+  // Records roughly one in `period` looked up keys for rebalance(), see
+  // access_sampler. A period of 0 disables sampling and frees the samples.
+  // Must be set while no other thread is using the table.
+  void set_access_sampling(size_t period) { sampler_.set_period(period); }
+
+  // Moves the most frequently sampled keys into slot 0 of their primary
+  // bucket, so that lookups for them hit on the first probe. Keys in their
+  // second bucket are only moved if a slot in the primary bucket can be freed
+  // without a displacement chain. Consumes the samples and returns the number
+  // of keys moved. Must not run concurrently with any other operation, e.g.
+  // call it from a maintenance thread between serving phases.
+  size_t rebalance(size_t max_moves = access_sampler::SAMPLE_SZ) {
+    std::vector<KeyT> hottest = sampler_.take_hottest();
+    size_t num_moved = 0;
+    for (size_t i = 0; i < hottest.size() && num_moved < max_moves; ++i) {
+      num_moved += promote(hottest[i]);
+    }
+    if (num_moved) {
+      bump_write_epoch();
+    }
+    return num_moved;
+  }
+
+ private:
+  static constexpr size_t MAX_INSERT_DEPTH = 256;
+  static constexpr double DEFAULT_SHRINK_LOAD = 0.5;
+  static constexpr size_t PARALLEL_MIN_BUCKETS =
+      detail::parallel_min_buckets<Bucket>();
+
+  struct clone_tag {};
+
+  // Allocates an uninitialized bucket array of the same size as `other`.
+  cuckoo_table(const cuckoo_table& other, const Allocator& allocator,
+               clone_tag)
+      : hash_fn_(other.hash_fn_),
+        allocator_(allocator),
+        num_buckets_(other.num_buckets_),
+        bucket_bitmask_(other.bucket_bitmask_),
+        buckets_(),
+        sz_(other.sz_),
+        sampler_(other.sampler_.clone()) {
+    if (other.allocated()) {
+      allocate_buckets();
+    } else {
+      buckets_ = unallocated();
+    }
+  }
+
+  void allocate_buckets() {
+    Bucket* buckets = allocator_.allocate(num_buckets_);
+    if ((uint64_t)(buckets) % hardware_constructive_interference_size != 0) {
+      allocator_.deallocate(buckets, num_buckets_);
+      throw std::runtime_error("buckets_ is not cache-aligned");
+    }
+    buckets_ = buckets;
+  }
+
+  // Gives a moved-from table a bucket array again.
+  void ensure_allocated() {
+    if (!allocated()) {
+      allocate_buckets();
+      reset_buckets();
+      bucket_bitmask_ = num_buckets_ - 1;
+    }
+  }
+
+  bool allocated() const { return buckets_ != unallocated(); }
+
+  // Stands in for the bucket array of a moved-from table. With a bitmask of 0
+  // every key maps to this one empty bucket, so lookups need no check.
+  static Bucket* unallocated() {
+    static Bucket bucket = empty_bucket();
+    return &bucket;
+  }
+
+  static Bucket empty_bucket() {
+    Bucket empty;
+    for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+      empty.erase(i);
+    }
+    return empty;
+  }
+
+  // Empties every slot, filling whole buckets from an empty template so that
+  // the stores vectorize, in parallel for large arrays.
+  void reset_buckets() {
+    if (!allocated()) {
+      return;
+    }
+    Bucket empty = empty_bucket();
+    parallel_for(num_buckets_, PARALLEL_MIN_BUCKETS,
+                 [&](size_t begin, size_t end) {
+                   std::fill(buckets_ + begin, buckets_ + end, empty);
+                 });
+  }
 
+  // Moves `key` into slot 0 of its primary bucket, returns whether it moved.
+  bool promote(KeyT key) {
     size_t hash = hash_key(key);
     size_t bucket_id1 = get_bucket_id(hash);
+    Bucket& primary = buckets_[bucket_id1];
+
+    auto it = primary.find_simd(key);
+    if (!it.is_null()) {
+      if (it.slot_idx_ == 0) {
+        return false;
+      }
+      primary.swap_slots(0, it.slot_idx_);
+      return true;
+    }
+
     size_t bucket_id2 = get_other_bucket_id(hash, key);
+    it = buckets_[bucket_id2].find_simd(key);
+    if (it.is_null()) {
+      return false;
+    }
 
-    Bucket& bucket1 = buckets_[bucket_id1];
-    if (bucket1.insert(key, value)) {
-      return;
+    // free a slot in the primary bucket, either an empty one or one whose key
+    // can move to its own alternate bucket without displacing anything
+    size_t slot_idx = primary.find_empty();
+    for (size_t i = 0; i < SLOTS_PER_BUCKET && slot_idx == NULL_SLOT_IDX; ++i) {
+      KeyT victim = primary.key_slots[i];
+      size_t victim_hash = hash_key(victim);
+      size_t victim_id1 = get_bucket_id(victim_hash);
+      size_t victim_id2 = get_other_bucket_id(victim_hash, victim);
+      size_t alt_id = victim_id1 == bucket_id1 ? victim_id2 : victim_id1;
+      if (alt_id == bucket_id1) {
+        continue;
+      }
+
+      if (alt_id == bucket_id2) {
+        // trade places with the key being promoted
+        std::swap(primary.key_slots[i], it.bucket_->key_slots[it.slot_idx_]);
+        std::swap(primary.value_slots[i],
+                  it.bucket_->value_slots[it.slot_idx_]);
+        primary.swap_slots(0, i);
+        return true;
+      }
+
+      size_t alt_slot_idx = buckets_[alt_id].find_empty();
+      if (alt_slot_idx != NULL_SLOT_IDX) {
+        buckets_[alt_id].update(alt_slot_idx, victim, primary.value_slots[i]);
+        slot_idx = i;
+      }
+    }
+    if (slot_idx == NULL_SLOT_IDX) {
+      return false;
     }
 
-    Bucket& bucket2 = buckets_[bucket_id2];
-    if (bucket2.insert(key, value)) {
-      return;
+    primary.update(slot_idx, key, it.value());
+    it.bucket_->erase(it.slot_idx_);
+    primary.swap_slots(0, slot_idx);
+    return true;
+  }
+
+  // Each key is loaded once, while its buckets are being hashed, and the
+  // search reads it back from a local copy, MAX_LOOKUP_BATCH_SZ keys at a
+  // time.
+  template <class KeyLoader>
+  void find_batched_impl(KeyLoader load_key, size_t num_keys,
+                         iterator* results) {
+    std::array<KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+    batch_state state;
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      size_t batch_sz = std::min(num_keys - base, MAX_LOOKUP_BATCH_SZ);
+      prefetch_batched_impl(
+          [&](size_t i) { return keys[i] = load_key(base + i); }, batch_sz,
+          state);
+      search_batched(keys.data(), batch_sz, state, results + base);
+    }
+  }
+
+  template <class KeyLoader>
+  void prefetch_batched_impl(KeyLoader load_key, size_t num_keys,
+                             batch_state& state) {
+    // compute hashes and prefetch buckets
+    for (size_t i = 0; i < num_keys; ++i) {
+      KeyT key = load_key(i);
+      size_t hash = hash_key(key);
+      state.bucket_id1s[i] = get_bucket_id(hash);
+      state.bucket_id2s[i] = get_other_bucket_id(hash, key);
+      __builtin_prefetch(&buckets_[state.bucket_id1s[i]], 0, 3);
+      __builtin_prefetch(&buckets_[state.bucket_id2s[i]], 0, 3);
+    }
+  }
+
+  iterator find_in_buckets(KeyT key, size_t bucket_id1, size_t bucket_id2) {
+    if (sampler_.enabled()) {
+      sampler_.record(key);
     }
 
-    return displace_insert(bucket_id1, key, value, 0);
+    return Bucket::find_pair_simd(buckets_[bucket_id1], buckets_[bucket_id2],
+                                  key);
   }
 
- private:
-  static constexpr size_t MAX_INSERT_DEPTH = 256;
+  void apply_op(Op& op, size_t bucket_id1, size_t bucket_id2) {
+    if (op.type != Op::Type::find) {
+      check_key(op.key);
+    }
+    iterator it = find_in_buckets(op.key, bucket_id1, bucket_id2);
+    op.found = !it.is_null();
+
+    switch (op.type) {
+      case Op::Type::find:
+        op.result = it;
+        break;
+      case Op::Type::insert:
+        if (!op.found) {
+          insert_into(bucket_id1, bucket_id2, op.key, op.value);
+        }
+        break;
+      case Op::Type::upsert:
+        if (op.found) {
+          it.value() = op.value;
+        } else {
+          insert_into(bucket_id1, bucket_id2, op.key, op.value);
+        }
+        break;
+      case Op::Type::erase:
+        if (op.found) {
+          erase(it);
+        }
+        break;
+    }
+  }
+
+  void insert_into(size_t bucket_id1, size_t bucket_id2, KeyT key,
+                   ValueT value) {
+    // throws on an existing key before anything is modified
+    bool inserted = Bucket::insert_pair(buckets_[bucket_id1],
+                                        buckets_[bucket_id2], key, value);
+    bump_write_epoch();
+    if (!inserted) {
+      displace_insert(bucket_id1, key, value, 0);
+    }
+    sz_++;
+  }
 
   void displace_insert(size_t bucket_id, KeyT key, ValueT value, size_t curr_depth) {
     if (curr_depth >= MAX_INSERT_DEPTH) {
       throw std::runtime_error{"cannot find insertion slot."};
     }
 
-    KvT displaced_slot = buckets_[bucket_id].displace_insert(key, value);
+    KvT displaced_slot =
+        buckets_[bucket_id].displace_insert(next_displace_idx(), key, value);
 
     size_t hash = hash_key(displaced_slot.first);
     size_t bucket_id1 = get_bucket_id(hash);
@@ -249,22 +858,28 @@ class cuckoo_table {
                            displaced_slot.second, curr_depth + 1);
   }
 
-  static constexpr uint64_t next_pow2(uint64_t x) {
-    x--;
-    x |= (x >> 1);
-    x |= (x >> 2);
-    x |= (x >> 4);
-    x |= (x >> 8);
-    x |= (x >> 16);
-    x |= (x >> 32);
-    x++;
-    return x;
+  static void check_key(KeyT key) {
+    if (key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+  }
+
+  // writers are not concurrent with each other, so no RMW is needed
+  void bump_write_epoch() {
+    write_epoch_.store(write_epoch_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+  }
+
+  size_t next_displace_idx() {
+    return (displace_rng_() >> 32) & (SLOTS_PER_BUCKET - 1);
   }
 
   size_t hash_key(KeyT key) { return hash_fn_(key); }
-  size_t get_bucket_id(size_t h) { return h & bucket_bitmask_; }
+  size_t get_bucket_id(size_t h) {
+    return detail::primary_bucket_id(h, bucket_bitmask_);
+  }
   size_t get_other_bucket_id(size_t h, KeyT k) {
-    return hash_fn_(h ^ k) & bucket_bitmask_;
+    return detail::alternate_bucket_id(hash_fn_, h, k, bucket_bitmask_);
   }
 
   Hash hash_fn_;
@@ -275,6 +890,10 @@ class cuckoo_table {
   Bucket* buckets_;
 
   size_t sz_{0};
+  std::atomic<uint64_t> write_epoch_{0};
+  xorshift64 displace_rng_;
+
+  access_sampler sampler_;
 };
 
 }  // namespace cuckoo
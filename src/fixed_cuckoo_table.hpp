@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "cuckoo_table.hpp"
+#include "table_util.hpp"
+
+namespace cuckoo {
+
+// A cuckoo_table whose capacity is known at compile time. The bucket array is
+// embedded in the object, so there is no pointer to chase, and the bucket
+// count and mask are constants that fold into the index math. Nothing is
+// allocated. Static instances start out empty through constant
+// initialization; any other instance empties its slots with one memset on
+// construction. It uses the same Bucket and SIMD search as cuckoo_table.
+//
+// Small instances can live on the stack (see small_cuckoo_table), large ones
+// should be static or heap-allocated.
+template <size_t Capacity, class Hash = std::hash<KeyT>>
+class fixed_cuckoo_table {
+  static_assert(Capacity >= SLOTS_PER_BUCKET);
+
+ public:
+  using iterator = Bucket::iterator;
+
+  fixed_cuckoo_table() = default;
+
+  // iterators point into the table itself
+  fixed_cuckoo_table(const fixed_cuckoo_table&) = delete;
+  fixed_cuckoo_table& operator=(const fixed_cuckoo_table&) = delete;
+
+  size_t size() { return sz_; }
+
+  double load_factor() {
+    return static_cast<double>(sz_) / (NUM_BUCKETS * SLOTS_PER_BUCKET);
+  }
+
+  iterator find(KeyT key) {
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+
+    auto it = buckets_[bucket_id1].find_simd(key);
+    if (!it.is_null()) {
+      return it;
+    }
+
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+    return buckets_[bucket_id2].find_simd(key);
+  }
+
+  void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
+    if constexpr (sizeof(buckets_) <= L1_RESIDENT_SZ) {
+      // nothing to overlap, the whole table stays in L1
+      for (size_t i = 0; i < num_keys; ++i) {
+        results[i] = find(keys[i]);
+      }
+      return;
+    }
+
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id1s;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> bucket_id2s;
+
+    // compute hashes and prefetch buckets
+    for (size_t i = 0; i < num_keys; ++i) {
+      size_t hash = hash_key(keys[i]);
+      bucket_id1s[i] = get_bucket_id(hash);
+      bucket_id2s[i] = get_other_bucket_id(hash, keys[i]);
+      __builtin_prefetch(&buckets_[bucket_id1s[i]], 0, 3);
+      __builtin_prefetch(&buckets_[bucket_id2s[i]], 0, 3);
+    }
+
+    // search both buckets at once via SIMD
+    for (size_t i = 0; i < num_keys; ++i) {
+      results[i] = Bucket::find_pair_simd(buckets_[bucket_id1s[i]],
+                                          buckets_[bucket_id2s[i]], keys[i]);
+    }
+  }
+
+  void erase(const iterator& it) {
+    sz_--;
+    it.bucket_->erase(it.slot_idx_);
+  }
+
+  // Throws std::invalid_argument for NULL_KEY, which marks empty slots.
+  void insert(KeyT key, ValueT value) {
+    if (key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+    size_t hash = hash_key(key);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, key);
+
+    if (!Bucket::insert_pair(buckets_[bucket_id1], buckets_[bucket_id2], key,
+                             value)) {
+      displace_insert(bucket_id1, key, value, 0);
+    }
+    sz_++;
+  }
+
+ private:
+  static constexpr size_t MAX_INSERT_DEPTH = 256;
+  static constexpr size_t L1_RESIDENT_SZ = 16 * 1024;
+
+  static constexpr size_t NUM_BUCKETS =
+      detail::next_pow2(Capacity) / SLOTS_PER_BUCKET;
+  static constexpr size_t BUCKET_BITMASK = NUM_BUCKETS - 1;
+
+  // Empty slots are all ones, so at run time one memset empties the array;
+  // the loop only runs in constant evaluation.
+  static_assert(NULL_KEY == ~KeyT{0} && NULL_VALUE == ~ValueT{0});
+  static_assert(std::is_trivially_copyable_v<Bucket>);
+
+  static constexpr std::array<Bucket, NUM_BUCKETS> empty_buckets() {
+    std::array<Bucket, NUM_BUCKETS> buckets;
+    if (std::is_constant_evaluated()) {
+      for (Bucket& bucket : buckets) {
+        bucket.key_slots.fill(NULL_KEY);
+        bucket.value_slots.fill(NULL_VALUE);
+      }
+    } else {
+      std::memset(buckets.data(), 0xff, sizeof(buckets));
+    }
+    return buckets;
+  }
+
+  void displace_insert(size_t bucket_id, KeyT key, ValueT value,
+                       size_t curr_depth) {
+    if (curr_depth >= MAX_INSERT_DEPTH) {
+      throw std::runtime_error{"cannot find insertion slot."};
+    }
+
+    KvT displaced_slot =
+        buckets_[bucket_id].displace_insert(next_displace_idx(), key, value);
+
+    size_t hash = hash_key(displaced_slot.first);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(hash, displaced_slot.first);
+
+    size_t nxt_bucket_id = bucket_id1 == bucket_id ? bucket_id2 : bucket_id1;
+    if (buckets_[nxt_bucket_id].insert(displaced_slot.first,
+                                       displaced_slot.second)) {
+      return;
+    }
+
+    return displace_insert(nxt_bucket_id, displaced_slot.first,
+                           displaced_slot.second, curr_depth + 1);
+  }
+
+  size_t next_displace_idx() {
+    return (displace_rng_() >> 32) & (SLOTS_PER_BUCKET - 1);
+  }
+
+  size_t hash_key(KeyT key) { return hash_fn_(key); }
+  size_t get_bucket_id(size_t h) {
+    return detail::primary_bucket_id(h, BUCKET_BITMASK);
+  }
+  size_t get_other_bucket_id(size_t h, KeyT k) {
+    return detail::alternate_bucket_id(hash_fn_, h, k, BUCKET_BITMASK);
+  }
+
+  [[no_unique_address]] Hash hash_fn_{};
+
+  std::array<Bucket, NUM_BUCKETS> buckets_ = empty_buckets();
+
+  size_t sz_{0};
+  xorshift64 displace_rng_;
+};
+
+}  // namespace cuckoo
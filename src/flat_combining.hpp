@@ -0,0 +1,186 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include "concurrent_cuckoo_table.hpp"
+#include "version_lock.hpp"
+
+namespace cuckoo {
+
+// Funnels the writes of many threads into one concurrent_cuckoo_table by
+// flat combining. A writer publishes its insert or erase in a slot of its
+// own and spins, and whichever writer takes the combiner role applies every
+// published op in one write_batched() call and hands back the results. At
+// moderate write rates on a hot table, this keeps its bucket lines and stripe
+// locks in the combiner's cache instead of moving them between writers.
+// Lookups go straight to the table.
+//
+// Writer threads register once and write through the handle they get back.
+template <class Table, size_t MaxThreads = 64>
+class flat_combining_table {
+ public:
+  using write_op = typename Table::write_op;
+
+  class handle {
+   public:
+    handle(handle&& other) noexcept
+        : owner_(std::exchange(other.owner_, nullptr)),
+          slot_idx_(other.slot_idx_) {}
+
+    handle(const handle&) = delete;
+    handle& operator=(const handle&) = delete;
+    handle& operator=(handle&&) = delete;
+
+    ~handle() {
+      if (owner_) {
+        owner_->slots_[slot_idx_].in_use.store(false,
+                                               std::memory_order_release);
+      }
+    }
+
+    // Throws if the key exists, or what the table threw for the op, e.g. if
+    // no room can be made for it.
+    void insert(KeyT key, ValueT value) {
+      if (owner_->execute(slot_idx_, {write_op::Type::insert, key, value})
+              .found) {
+        throw std::runtime_error{"tried to insert existing key"};
+      }
+    }
+
+    // Returns whether the key was present. Throws what the table threw for
+    // the op.
+    bool erase(KeyT key) {
+      return owner_->execute(slot_idx_, {write_op::Type::erase, key}).found;
+    }
+
+    std::optional<ValueT> find(KeyT key) { return owner_->table_.find(key); }
+
+   private:
+    friend class flat_combining_table;
+
+    handle(flat_combining_table* owner, size_t slot_idx)
+        : owner_(owner), slot_idx_(slot_idx) {}
+
+    flat_combining_table* owner_;
+    size_t slot_idx_;
+  };
+
+  explicit flat_combining_table(Table& table) : table_(table) {}
+
+  flat_combining_table(const flat_combining_table&) = delete;
+  flat_combining_table& operator=(const flat_combining_table&) = delete;
+
+  // Claims a slot for the calling thread until the handle is destroyed.
+  // Throws if all MaxThreads slots are taken.
+  handle register_thread() {
+    for (size_t i = 0; i < MaxThreads; ++i) {
+      bool expected = false;
+      if (slots_[i].in_use.compare_exchange_strong(
+              expected, true, std::memory_order_acquire)) {
+        return handle(this, i);
+      }
+    }
+    throw std::runtime_error{"no free combining slot"};
+  }
+
+ private:
+  enum class slot_state : uint8_t { idle, pending, done, failed };
+
+  struct alignas(64) slot {
+    std::atomic<bool> in_use{false};
+    std::atomic<slot_state> state{slot_state::idle};
+    write_op op;
+    // what the table threw for `op`, set with slot_state::failed
+    std::exception_ptr error;
+  };
+
+  // Hands the combiner role back on scope exit, even if combine() throws.
+  class combiner_guard {
+   public:
+    explicit combiner_guard(std::atomic<bool>& combining)
+        : combining_(combining) {}
+    combiner_guard(const combiner_guard&) = delete;
+    combiner_guard& operator=(const combiner_guard&) = delete;
+    ~combiner_guard() { combining_.store(false, std::memory_order_release); }
+
+   private:
+    std::atomic<bool>& combining_;
+  };
+
+  write_op execute(size_t slot_idx, const write_op& op) {
+    slot& s = slots_[slot_idx];
+    s.op = op;
+    s.state.store(slot_state::pending, std::memory_order_release);
+
+    slot_state state;
+    while ((state = s.state.load(std::memory_order_acquire)) ==
+           slot_state::pending) {
+      if (!combining_.load(std::memory_order_relaxed) &&
+          !combining_.exchange(true, std::memory_order_acquire)) {
+        combiner_guard guard(combining_);
+        combine();
+      } else {
+        cpu_relax();
+      }
+    }
+
+    s.state.store(slot_state::idle, std::memory_order_relaxed);
+    if (state == slot_state::failed) {
+      std::rethrow_exception(std::exchange(s.error, nullptr));
+    }
+    return s.op;
+  }
+
+  // Applies every published op as one batch. An op the table throws for,
+  // such as an insert that finds no room, fails on its own with that
+  // exception, and the ops after it are applied in a new batch.
+  void combine() {
+    std::array<write_op, MaxThreads> ops;
+    std::array<size_t, MaxThreads> slot_idxs;
+    std::array<std::exception_ptr, MaxThreads> errors;
+    size_t num_ops = 0;
+    for (size_t i = 0; i < MaxThreads; ++i) {
+      if (slots_[i].state.load(std::memory_order_acquire) ==
+          slot_state::pending) {
+        ops[num_ops] = slots_[i].op;
+        slot_idxs[num_ops++] = i;
+      }
+    }
+
+    size_t begin = 0;
+    while (begin < num_ops) {
+      try {
+        table_.write_batched(ops.data() + begin, num_ops - begin);
+        begin = num_ops;
+      } catch (...) {
+        while (begin < num_ops && ops[begin].applied) {
+          begin++;
+        }
+        if (begin < num_ops) {
+          errors[begin++] = std::current_exception();
+        }
+      }
+    }
+
+    for (size_t i = 0; i < num_ops; ++i) {
+      slot& s = slots_[slot_idxs[i]];
+      s.op = ops[i];
+      s.error = std::move(errors[i]);
+      s.state.store(s.error ? slot_state::failed : slot_state::done,
+                    std::memory_order_release);
+    }
+  }
+
+  Table& table_;
+  alignas(64) std::atomic<bool> combining_{false};
+  std::array<slot, MaxThreads> slots_;
+};
+
+}  // namespace cuckoo
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <arm_neon.h>
+
+#include "table_util.hpp"
+#include "xorshift.hpp"
+
+namespace flow_table {
+
+// assume cache line size is 64B
+constexpr std::size_t hardware_constructive_interference_size = 64;
+
+// Packed connection tracking keys, compared bytewise.
+struct __attribute__((packed)) ipv4_5tuple {
+  uint32_t src_addr;
+  uint32_t dst_addr;
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint8_t proto;
+};
+static_assert(sizeof(ipv4_5tuple) == 13);
+
+struct __attribute__((packed)) ipv6_5tuple {
+  std::array<uint8_t, 16> src_addr;
+  std::array<uint8_t, 16> dst_addr;
+  uint16_t src_port;
+  uint16_t dst_port;
+  uint8_t proto;
+};
+static_assert(sizeof(ipv6_5tuple) == 37);
+
+using ValueT = uint64_t;
+using TimestampT = uint32_t;
+using TagT = uint16_t;
+
+constexpr ValueT NULL_VALUE = -1;
+constexpr TagT NULL_TAG = 0;
+
+constexpr size_t NULL_SLOT_IDX = -1;
+constexpr size_t SLOTS_PER_BUCKET = 8;
+static_assert((SLOTS_PER_BUCKET & (SLOTS_PER_BUCKET - 1)) == 0);
+
+// DPDK-style bursts are 32 or 64 packets
+constexpr size_t MAX_BURST_SZ = 64;
+
+// Default hash, folds the key 8 bytes at a time with the murmur3 finalizer.
+template <class FlowKeyT>
+struct flow_hash {
+  size_t operator()(const FlowKeyT& key) const noexcept {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&key);
+    uint64_t h = sizeof(FlowKeyT);
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= sizeof(FlowKeyT); i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, bytes + i, sizeof(uint64_t));
+      h = mix(h ^ word);
+    }
+    if (i < sizeof(FlowKeyT)) {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes + i, sizeof(FlowKeyT) - i);
+      h = mix(h ^ word);
+    }
+    return h;
+  }
+
+ private:
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+};
+
+// A bucket only holds the 16-bit tags and last-seen timestamps of its flows,
+// so the tag filter and aging scans touch a single cache line. Keys and values
+// live in a separate entry array that is only read on a tag match.
+struct alignas(hardware_constructive_interference_size) Bucket {
+  std::array<TagT, SLOTS_PER_BUCKET> tags;
+  std::array<TimestampT, SLOTS_PER_BUCKET> timestamps;
+
+  // Returns 8 bits per slot, set if the slot's tag matches.
+  uint64_t match_tags(TagT tag) const {
+    static_assert(SLOTS_PER_BUCKET == 8, "Only 8 slots supported");
+
+    uint16x8_t cmp = vceqq_u16(vld1q_u16(tags.data()), vdupq_n_u16(tag));
+    return vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(cmp)), 0);
+  }
+
+  uint64_t empty_slots() const { return match_tags(NULL_TAG); }
+
+  static size_t first_slot(uint64_t mask) {
+    return static_cast<size_t>(__builtin_ctzll(mask)) / 8;
+  }
+
+  static uint64_t clear_slot(uint64_t mask, size_t slot_idx) {
+    return mask & ~(0xFFULL << (slot_idx * 8));
+  }
+};
+static_assert(alignof(Bucket) == hardware_constructive_interference_size);
+static_assert(sizeof(Bucket) == hardware_constructive_interference_size);
+
+template <class FlowKeyT,
+          class Hash = flow_hash<FlowKeyT>,
+          class Allocator = std::allocator<Bucket>>
+class flow_table {
+ public:
+  struct Entry {
+    FlowKeyT key;
+    ValueT value;
+  };
+
+  struct iterator {
+    iterator()
+        : bucket_(nullptr), entry_(nullptr), slot_idx_(NULL_SLOT_IDX) {}
+
+    iterator(Bucket* bucket, Entry* entry, size_t slot_idx)
+        : bucket_(bucket), entry_(entry), slot_idx_(slot_idx) {}
+
+    bool is_null() const { return slot_idx_ == NULL_SLOT_IDX; }
+
+    const FlowKeyT& key() const { return entry_->key; }
+    ValueT& value() { return entry_->value; }
+    TimestampT& timestamp() { return bucket_->timestamps[slot_idx_]; }
+
+    Bucket* bucket_;
+    Entry* entry_;
+    size_t slot_idx_;
+  };
+
+  flow_table(size_t capacity)
+      : hash_fn_(),
+        allocator_(),
+        entry_allocator_(allocator_),
+        num_buckets_(cuckoo::detail::next_pow2(capacity) / SLOTS_PER_BUCKET),
+        bucket_bitmask_(num_buckets_ - 1),
+        buckets_(),
+        entries_() {
+    if (num_buckets_ == 0 || (num_buckets_ & (num_buckets_ - 1)) != 0) {
+      throw std::invalid_argument("num_buckets must be a power of 2");
+    }
+
+    buckets_ = allocator_.allocate(num_buckets_);
+    if ((uint64_t)(buckets_) % hardware_constructive_interference_size != 0) {
+      allocator_.deallocate(buckets_, num_buckets_);
+      throw std::runtime_error("buckets_ is not cache-aligned");
+    }
+    try {
+      entries_ = entry_allocator_.allocate(num_buckets_ * SLOTS_PER_BUCKET);
+    } catch (...) {
+      allocator_.deallocate(buckets_, num_buckets_);
+      throw;
+    }
+
+    // initialize slots, entries are only read behind a matching tag
+    for (size_t i = 0; i < num_buckets_; ++i) {
+      buckets_[i].tags.fill(NULL_TAG);
+      buckets_[i].timestamps.fill(0);
+    }
+  }
+
+  flow_table(const flow_table&) = delete;
+  flow_table& operator=(const flow_table&) = delete;
+
+  ~flow_table() {
+    if (buckets_) {
+      allocator_.deallocate(buckets_, num_buckets_);
+    }
+    if (entries_) {
+      entry_allocator_.deallocate(entries_, num_buckets_ * SLOTS_PER_BUCKET);
+    }
+  }
+
+  size_t size() { return sz_; }
+
+  double load_factor() {
+    return static_cast<double>(sz_) / (num_buckets_ * SLOTS_PER_BUCKET);
+  }
+
+  iterator find(const FlowKeyT& key) {
+    size_t hash = hash_fn_(key);
+    TagT tag = get_tag(hash);
+    size_t bucket_id1 = get_bucket_id(hash);
+
+    auto it = find_in_bucket(bucket_id1, tag, key);
+    if (!it.is_null()) {
+      return it;
+    }
+    return find_in_bucket(get_other_bucket_id(bucket_id1, tag), tag, key);
+  }
+
+  // Looks up a burst of keys read from `base + i * stride`, e.g. the 5-tuple
+  // embedded in an array of packet metadata. Bucket lines are prefetched for
+  // the whole burst, then tags are filtered and the entry of the first tag
+  // match is prefetched, and only then are full keys compared. Bursts longer
+  // than MAX_BURST_SZ are looked up MAX_BURST_SZ keys at a time.
+  void lookup_burst(const void* base, size_t stride, size_t num_keys,
+                    iterator* results) {
+    lookup_burst_impl<false>(base, stride, num_keys, results, 0);
+  }
+
+  // As above, and refreshes the timestamp of every flow that is hit.
+  void lookup_burst(const void* base, size_t stride, size_t num_keys,
+                    iterator* results, TimestampT now) {
+    lookup_burst_impl<true>(base, stride, num_keys, results, now);
+  }
+
+  void erase(const iterator& it) {
+    sz_--;
+    it.bucket_->tags[it.slot_idx_] = NULL_TAG;
+  }
+
+  iterator insert(const FlowKeyT& key, ValueT value, TimestampT now) {
+    size_t hash = hash_fn_(key);
+    TagT tag = get_tag(hash);
+    size_t bucket_id1 = get_bucket_id(hash);
+    size_t bucket_id2 = get_other_bucket_id(bucket_id1, tag);
+
+    if (!find_in_bucket(bucket_id1, tag, key).is_null() ||
+        !find_in_bucket(bucket_id2, tag, key).is_null()) {
+      throw std::runtime_error{"tried to insert existing key"};
+    }
+
+    sz_++;
+
+    for (size_t bucket_id : {bucket_id1, bucket_id2}) {
+      uint64_t empty = buckets_[bucket_id].empty_slots();
+      if (empty) {
+        size_t slot_idx = Bucket::first_slot(empty);
+        update(bucket_id, slot_idx, tag, {key, value}, now);
+        return make_iterator(bucket_id, slot_idx);
+      }
+    }
+
+    displace_insert(bucket_id1, tag, {key, value}, now, 0);
+    return find(key);
+  }
+
+  // Scans up to `max_buckets` buckets from where the previous call stopped
+  // and erases every flow not seen within `timeout` of `now`. Returns the
+  // number of flows that expired.
+  size_t age(TimestampT now, TimestampT timeout, size_t max_buckets) {
+    size_t num_expired = 0;
+    for (size_t i = 0; i < max_buckets && i < num_buckets_; ++i) {
+      Bucket& bucket = buckets_[age_cursor_];
+      for (size_t j = 0; j < SLOTS_PER_BUCKET; ++j) {
+        if (bucket.tags[j] != NULL_TAG &&
+            static_cast<TimestampT>(now - bucket.timestamps[j]) > timeout) {
+          bucket.tags[j] = NULL_TAG;
+          num_expired++;
+        }
+      }
+      age_cursor_ = (age_cursor_ + 1) & bucket_bitmask_;
+    }
+    sz_ -= num_expired;
+    return num_expired;
+  }
+
+ private:
+  static constexpr size_t MAX_INSERT_DEPTH = 256;
+
+  template <bool Touch>
+  void lookup_burst_impl(const void* base, size_t stride, size_t num_keys,
+                         iterator* results, TimestampT now) {
+    const auto* bytes = static_cast<const uint8_t*>(base);
+    for (size_t begin = 0; begin < num_keys; begin += MAX_BURST_SZ) {
+      lookup_chunk<Touch>(bytes + begin * stride, stride,
+                          std::min(MAX_BURST_SZ, num_keys - begin),
+                          results + begin, now);
+    }
+  }
+
+  // Looks up at most MAX_BURST_SZ keys, see lookup_burst().
+  template <bool Touch>
+  void lookup_chunk(const uint8_t* bytes, size_t stride, size_t num_keys,
+                    iterator* results, TimestampT now) {
+    std::array<FlowKeyT, MAX_BURST_SZ> keys;
+    std::array<size_t, MAX_BURST_SZ> bucket_id1s;
+    std::array<size_t, MAX_BURST_SZ> bucket_id2s;
+    std::array<TagT, MAX_BURST_SZ> tags;
+    std::array<uint64_t, MAX_BURST_SZ> matches1;
+    std::array<uint64_t, MAX_BURST_SZ> matches2;
+
+    // gather keys, compute hashes and prefetch buckets
+    for (size_t i = 0; i < num_keys; ++i) {
+      std::memcpy(&keys[i], bytes + i * stride, sizeof(FlowKeyT));
+      size_t hash = hash_fn_(keys[i]);
+      tags[i] = get_tag(hash);
+      bucket_id1s[i] = get_bucket_id(hash);
+      bucket_id2s[i] = get_other_bucket_id(bucket_id1s[i], tags[i]);
+      __builtin_prefetch(&buckets_[bucket_id1s[i]], Touch, 3);
+      __builtin_prefetch(&buckets_[bucket_id2s[i]], Touch, 3);
+    }
+
+    // filter by tag and prefetch the first candidate entry
+    for (size_t i = 0; i < num_keys; ++i) {
+      matches1[i] = buckets_[bucket_id1s[i]].match_tags(tags[i]);
+      matches2[i] = buckets_[bucket_id2s[i]].match_tags(tags[i]);
+      if (matches1[i]) {
+        __builtin_prefetch(
+            &entries_[entry_idx(bucket_id1s[i], Bucket::first_slot(matches1[i]))],
+            0, 3);
+      } else if (matches2[i]) {
+        __builtin_prefetch(
+            &entries_[entry_idx(bucket_id2s[i], Bucket::first_slot(matches2[i]))],
+            0, 3);
+      }
+    }
+
+    // compare full keys of the candidates
+    for (size_t i = 0; i < num_keys; ++i) {
+      results[i] = match_entries(bucket_id1s[i], matches1[i], keys[i]);
+      if (results[i].is_null()) {
+        results[i] = match_entries(bucket_id2s[i], matches2[i], keys[i]);
+      }
+      if constexpr (Touch) {
+        if (!results[i].is_null()) {
+          results[i].timestamp() = now;
+        }
+      }
+    }
+  }
+
+  iterator find_in_bucket(size_t bucket_id, TagT tag, const FlowKeyT& key) {
+    return match_entries(bucket_id, buckets_[bucket_id].match_tags(tag), key);
+  }
+
+  iterator match_entries(size_t bucket_id, uint64_t matches,
+                         const FlowKeyT& key) {
+    while (matches) {
+      size_t slot_idx = Bucket::first_slot(matches);
+      if (std::memcmp(&entries_[entry_idx(bucket_id, slot_idx)].key, &key,
+                      sizeof(FlowKeyT)) == 0) {
+        return make_iterator(bucket_id, slot_idx);
+      }
+      matches = Bucket::clear_slot(matches, slot_idx);
+    }
+    return {};
+  }
+
+  void displace_insert(size_t bucket_id, TagT tag, const Entry& entry,
+                       TimestampT now, size_t curr_depth) {
+    if (curr_depth >= MAX_INSERT_DEPTH) {
+      throw std::runtime_error{"cannot find insertion slot."};
+    }
+
+    Bucket& bucket = buckets_[bucket_id];
+    size_t disp_idx = next_displace_idx();
+    TagT displaced_tag = bucket.tags[disp_idx];
+    TimestampT displaced_ts = bucket.timestamps[disp_idx];
+    Entry displaced_entry = entries_[entry_idx(bucket_id, disp_idx)];
+    update(bucket_id, disp_idx, tag, entry, now);
+
+    // the alternate bucket only depends on the tag, so the displaced entry
+    // never has to be rehashed
+    size_t nxt_bucket_id = get_other_bucket_id(bucket_id, displaced_tag);
+    uint64_t empty = buckets_[nxt_bucket_id].empty_slots();
+    if (empty) {
+      update(nxt_bucket_id, Bucket::first_slot(empty), displaced_tag,
+             displaced_entry, displaced_ts);
+      return;
+    }
+
+    return displace_insert(nxt_bucket_id, displaced_tag, displaced_entry,
+                           displaced_ts, curr_depth + 1);
+  }
+
+  void update(size_t bucket_id, size_t slot_idx, TagT tag, const Entry& entry,
+              TimestampT ts) {
+    buckets_[bucket_id].tags[slot_idx] = tag;
+    buckets_[bucket_id].timestamps[slot_idx] = ts;
+    entries_[entry_idx(bucket_id, slot_idx)] = entry;
+  }
+
+  iterator make_iterator(size_t bucket_id, size_t slot_idx) {
+    return {&buckets_[bucket_id], &entries_[entry_idx(bucket_id, slot_idx)],
+            slot_idx};
+  }
+
+  size_t next_displace_idx() {
+    return (displace_rng_() >> 32) & (SLOTS_PER_BUCKET - 1);
+  }
+
+  static size_t entry_idx(size_t bucket_id, size_t slot_idx) {
+    return bucket_id * SLOTS_PER_BUCKET + slot_idx;
+  }
+
+  // tags come from the high bits, bucket ids from the low bits of the hash
+  static TagT get_tag(size_t h) {
+    TagT tag = static_cast<TagT>(h >> 48);
+    return tag == NULL_TAG ? 1 : tag;
+  }
+  size_t get_bucket_id(size_t h) {
+    return cuckoo::detail::primary_bucket_id(h, bucket_bitmask_);
+  }
+  size_t get_other_bucket_id(size_t bucket_id, TagT tag) {
+    return (bucket_id ^ (tag * 0x5bd1e995ULL)) & bucket_bitmask_;
+  }
+
+  using EntryAllocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+
+  Hash hash_fn_;
+  Allocator allocator_;
+  EntryAllocator entry_allocator_;
+
+  size_t num_buckets_;
+  size_t bucket_bitmask_;
+  Bucket* buckets_;
+  Entry* entries_;
+
+  size_t sz_{0};
+  size_t age_cursor_{0};
+  cuckoo::xorshift64 displace_rng_;
+};
+
+}  // namespace flow_table
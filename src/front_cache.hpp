@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "cuckoo_table.hpp"
+
+namespace cuckoo {
+
+// A small set-associative cache of iterators that sits in front of a
+// cuckoo_table or cuckoo_set. It is meant to be owned by a single thread and
+// sized to stay L1-resident, so that under skewed traffic hot keys are served
+// without hashing or touching the table's buckets. Misses are cached as well.
+//
+// Cached iterators are only valid while the table is not written to, so the
+// whole cache is dropped whenever the table's write epoch has moved.
+template <class Table, size_t NUM_SETS = 256, size_t WAYS = 2>
+class front_cache {
+  static_assert((NUM_SETS & (NUM_SETS - 1)) == 0);
+  static_assert(WAYS >= 1);
+
+ public:
+  using iterator = typename Table::iterator;
+
+  explicit front_cache(Table& table)
+      : table_(table), epoch_(table.write_epoch()) {
+    clear();
+  }
+
+  iterator find(KeyT key) {
+    sync_epoch();
+
+    Set& set = sets_[set_idx(key)];
+    iterator it;
+    if (lookup(set, key, it)) {
+      return it;
+    }
+
+    it = table_.find(key);
+    fill(set, key, it);
+    return it;
+  }
+
+  // Serves hits from the cache and forwards the misses to the table's
+  // find_batched() as one smaller batch, MAX_LOOKUP_BATCH_SZ keys at a time.
+  void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
+    sync_epoch();
+
+    for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+      find_chunk(keys + base, std::min(num_keys - base, MAX_LOOKUP_BATCH_SZ),
+                 results + base);
+    }
+  }
+
+  void clear() {
+    for (Set& set : sets_) {
+      set.keys.fill(NULL_KEY);
+    }
+  }
+
+ private:
+  // ways are kept in most-recently-used order
+  struct Set {
+    std::array<KeyT, WAYS> keys;
+    std::array<iterator, WAYS> its;
+  };
+
+  void find_chunk(const KeyT* keys, size_t num_keys, iterator* results) {
+    std::array<KeyT, MAX_LOOKUP_BATCH_SZ> miss_keys;
+    std::array<size_t, MAX_LOOKUP_BATCH_SZ> miss_idxs;
+    size_t num_misses = 0;
+    for (size_t i = 0; i < num_keys; ++i) {
+      if (!lookup(sets_[set_idx(keys[i])], keys[i], results[i])) {
+        miss_keys[num_misses] = keys[i];
+        miss_idxs[num_misses] = i;
+        num_misses++;
+      }
+    }
+    if (num_misses == 0) {
+      return;
+    }
+
+    std::array<iterator, MAX_LOOKUP_BATCH_SZ> miss_results;
+    table_.find_batched(miss_keys.data(), num_misses, miss_results.data());
+    for (size_t i = 0; i < num_misses; ++i) {
+      results[miss_idxs[i]] = miss_results[i];
+      fill(sets_[set_idx(miss_keys[i])], miss_keys[i], miss_results[i]);
+    }
+  }
+
+  void sync_epoch() {
+    uint64_t epoch = table_.write_epoch();
+    if (epoch != epoch_) {
+      clear();
+      epoch_ = epoch;
+    }
+  }
+
+  static bool lookup(Set& set, KeyT key, iterator& it) {
+    for (size_t w = 0; w < WAYS; ++w) {
+      if (set.keys[w] == key) {
+        it = set.its[w];
+        for (; w > 0; --w) {
+          std::swap(set.keys[w], set.keys[w - 1]);
+          std::swap(set.its[w], set.its[w - 1]);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void fill(Set& set, KeyT key, const iterator& it) {
+    for (size_t w = WAYS - 1; w > 0; --w) {
+      set.keys[w] = set.keys[w - 1];
+      set.its[w] = set.its[w - 1];
+    }
+    set.keys[0] = key;
+    set.its[0] = it;
+  }
+
+  // Fibonacci hashing, independent of the table's hash function
+  static size_t set_idx(KeyT key) {
+    constexpr int SHIFT = 64 - std::countr_zero(NUM_SETS);
+    if constexpr (NUM_SETS == 1) {
+      return 0;
+    } else {
+      return (key * 0x9E3779B97F4A7C15ULL) >> SHIFT;
+    }
+  }
+
+  Table& table_;
+  uint64_t epoch_;
+  std::array<Set, NUM_SETS> sets_;
+};
+
+}  // namespace cuckoo
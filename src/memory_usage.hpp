@@ -0,0 +1,72 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cuckoo {
+
+// Memory footprint of a table's bucket array, see memory_usage().
+struct memory_usage_info {
+  // bucket array size rounded up to whole backing pages
+  size_t bytes_allocated;
+  // bytes of the bucket array currently backed by physical memory
+  size_t bytes_resident;
+  // size of the pages backing the bucket array
+  size_t page_size;
+  size_t num_buckets;
+  // fraction of the allocated bytes holding live keys and values
+  double slot_efficiency;
+};
+
+namespace detail {
+
+// Page size backing an allocation of `bytes`. Allocators whose pages depend
+// on the size report it through a static page_size(bytes), as pool_allocator
+// does. Allocators that always map huge pages advertise their size, as
+// huge_page_allocator does; anything else is assumed to use base pages.
+template <class Allocator>
+size_t backing_page_size(size_t bytes) {
+  if constexpr (requires { Allocator::page_size(bytes); }) {
+    return Allocator::page_size(bytes);
+  } else if constexpr (requires { Allocator::huge_page_size; }) {
+    return Allocator::huge_page_size;
+  } else {
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  }
+}
+
+inline size_t round_up(size_t bytes, size_t page_size) {
+  return (bytes + page_size - 1) / page_size * page_size;
+}
+
+// Counts resident bytes in [p, p + bytes) with mincore(), at base page
+// granularity. Pages the range only partly overlaps count as a whole, up to
+// the range's size rounded to pages. Returns 0 if it cannot be queried.
+inline size_t resident_bytes(const void* p, size_t bytes) {
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t begin = reinterpret_cast<uintptr_t>(p) / page_size * page_size;
+  uintptr_t end = round_up(reinterpret_cast<uintptr_t>(p) + bytes, page_size);
+  if (bytes == 0) {
+    return 0;
+  }
+
+  std::vector<unsigned char> pages((end - begin) / page_size);
+  if (mincore(reinterpret_cast<void*>(begin), end - begin, pages.data()) != 0) {
+    return 0;
+  }
+
+  size_t num_resident = 0;
+  for (unsigned char page : pages) {
+    num_resident += page & 1;
+  }
+  return std::min(num_resident * page_size, round_up(bytes, page_size));
+}
+
+}  // namespace detail
+
+}  // namespace cuckoo
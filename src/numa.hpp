@@ -0,0 +1,177 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// NUMA placement without libnuma: node topology comes from sysfs and memory
+// policy from the mbind and getcpu system calls. On machines with a single
+// node, or kernels and sandboxes without NUMA support, everything degrades to
+// node 0 and the default policy.
+
+namespace cuckoo {
+
+namespace numa {
+
+// highest node id plus one that the helpers below handle
+constexpr size_t MAX_NODES = 64;
+
+namespace detail {
+
+// Calls `fn(id)` for every id in a sysfs list such as "0-3,8,10-11".
+template <class Fn>
+bool for_each_in_list(const std::string& path, Fn&& fn) {
+  std::ifstream in(path);
+  std::string list;
+  if (!std::getline(in, list)) {
+    return false;
+  }
+
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    size_t dash = range.find('-');
+    try {
+      size_t first = std::stoul(range.substr(0, dash));
+      size_t last = dash == std::string::npos
+                        ? first
+                        : std::stoul(range.substr(dash + 1));
+      for (size_t id = first; id <= last; ++id) {
+        fn(id);
+      }
+    } catch (const std::logic_error&) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace detail
+
+// Number of nodes, i.e. the highest online node id plus one. 1 if the
+// topology cannot be read.
+inline size_t num_nodes() {
+  size_t n = 1;
+  detail::for_each_in_list("/sys/devices/system/node/online",
+                           [&](size_t node) { n = std::max(n, node + 1); });
+  return std::min(n, MAX_NODES);
+}
+
+// Node of the CPU the calling thread runs on, 0 if it cannot be queried.
+// Costs a system call; the thread may migrate right after it returns.
+inline size_t current_node() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return 0;
+  }
+  return node;
+}
+
+// Restricts the calling thread to the CPUs of `node`. Returns false, leaving
+// the affinity alone, if the node's CPUs cannot be read or set.
+inline bool bind_thread(size_t node) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  bool read = detail::for_each_in_list(
+      "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist",
+      [&](size_t cpu) {
+        if (cpu < CPU_SETSIZE) {
+          CPU_SET(cpu, &cpus);
+        }
+      });
+  return read && CPU_COUNT(&cpus) > 0 &&
+         sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+}  // namespace numa
+
+// Allocates huge pages, as huge_page_allocator does, bound to one NUMA node
+// or interleaved across all of them. The policy is set with mbind() before
+// the pages are first touched, so it holds whichever thread faults them in.
+// Where mbind() is unavailable or not permitted, the pages keep the default
+// policy.
+template <typename T>
+class numa_allocator {
+ public:
+  constexpr static std::size_t huge_page_size = 1 << 21;  // 2 MiB
+  constexpr static int INTERLEAVE = -1;
+  using value_type = T;
+
+  explicit numa_allocator(int node = INTERLEAVE) : node_(node) {}
+
+  template <class U>
+  numa_allocator(const numa_allocator<U>& other) noexcept
+      : node_(other.node()) {}
+
+  int node() const { return node_; }
+
+  T* allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    size_t bytes = round_to_huge_page_size(n * sizeof(T));
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (!bind(p, bytes)) {
+      munmap(p, bytes);
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    munmap(p, round_to_huge_page_size(n * sizeof(T)));
+  }
+
+  bool operator==(const numa_allocator& other) const noexcept {
+    return node_ == other.node_;
+  }
+
+ private:
+  static size_t round_to_huge_page_size(size_t n) {
+    return (((n - 1) / huge_page_size) + 1) * huge_page_size;
+  }
+
+  bool bind(void* p, size_t bytes) const {
+    unsigned long nodemask = 0;
+    int mode;
+    if (node_ == INTERLEAVE) {
+      mode = MPOL_INTERLEAVE;
+      size_t n = numa::num_nodes();
+      nodemask = n == numa::MAX_NODES ? ~0ul : (1ul << n) - 1;
+    } else if (static_cast<size_t>(node_) < numa::MAX_NODES) {
+      mode = MPOL_BIND;
+      nodemask = 1ul << node_;
+    } else {
+      return false;
+    }
+
+    // the kernel reads one bit less than maxnode
+    constexpr unsigned long maxnode = numa::MAX_NODES + 1;
+    if (syscall(SYS_mbind, p, bytes, mode, &nodemask, maxnode, 0) == 0) {
+      return true;
+    }
+    return errno == ENOSYS || errno == EPERM;
+  }
+
+  int node_;
+};
+
+}  // namespace cuckoo
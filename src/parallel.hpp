@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace cuckoo {
+
+// Splits [0, n) into contiguous ranges and calls `fn(begin, end)` for each of
+// them, on up to one thread per core. Ranges are at least `min_per_thread`
+// long, so small inputs run on the calling thread without spawning anything.
+template <class Fn>
+void parallel_for(size_t n, size_t min_per_thread, Fn&& fn) {
+  size_t num_threads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()),
+      std::max<size_t>(1, n / std::max<size_t>(1, min_per_thread)));
+  if (num_threads <= 1) {
+    fn(size_t{0}, n);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  size_t chunk = (n + num_threads - 1) / num_threads;
+  for (size_t begin = chunk; begin < n; begin += chunk) {
+    threads.emplace_back(fn, begin, std::min(n, begin + chunk));
+  }
+  fn(size_t{0}, std::min(n, chunk));
+
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+}  // namespace cuckoo
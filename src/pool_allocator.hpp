@@ -0,0 +1,172 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace cuckoo {
+
+// A process-wide pool of bucket arrays in power-of-two size classes. Freed
+// arrays are kept mapped and handed to the next allocation of the same class,
+// first from a small per-thread cache and then from a shared free list, so
+// that creating and destroying many short-lived tables costs no mmap/munmap.
+// Arrays of 2 MiB and up are backed by huge pages when the system has them.
+class bucket_pool {
+ public:
+  static constexpr size_t huge_page_size = 1 << 21;  // 2 MiB
+  static constexpr size_t min_block_size = 1 << 12;  // 4 KiB
+
+  static bucket_pool& instance() {
+    static bucket_pool pool;
+    return pool;
+  }
+
+  void* allocate(size_t bytes) {
+    size_t cls = size_class(bytes);
+
+    thread_cache& cache = local_cache();
+    if (cache.counts[cls] > 0) {
+      return cache.blocks[cls][--cache.counts[cls]];
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_lists_[cls].empty()) {
+        void* p = free_lists_[cls].back();
+        free_lists_[cls].pop_back();
+        return p;
+      }
+    }
+    return map_block(block_size(cls));
+  }
+
+  void deallocate(void* p, size_t bytes) {
+    size_t cls = size_class(bytes);
+
+    thread_cache& cache = local_cache();
+    if (cache.counts[cls] < THREAD_CACHE_SZ) {
+      cache.blocks[cls][cache.counts[cls]++] = p;
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_lists_[cls].push_back(p);
+  }
+
+  // Size of the pages backing an allocation of `bytes`: huge pages once its
+  // size class reaches huge_page_size, reserved or transparent, base pages
+  // below that.
+  static size_t page_size(size_t bytes) {
+    if (block_size(size_class(bytes)) >= huge_page_size) {
+      return huge_page_size;
+    }
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  }
+
+  // Unmaps every array in the shared free lists. Arrays cached by threads stay
+  // mapped until those threads exit.
+  void trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t cls = 0; cls < NUM_CLASSES; ++cls) {
+      for (void* p : free_lists_[cls]) {
+        munmap(p, block_size(cls));
+      }
+      free_lists_[cls].clear();
+    }
+  }
+
+ private:
+  static constexpr size_t NUM_CLASSES = std::numeric_limits<size_t>::digits;
+  static constexpr size_t THREAD_CACHE_SZ = 4;
+
+  struct thread_cache {
+    std::array<std::array<void*, THREAD_CACHE_SZ>, NUM_CLASSES> blocks;
+    std::array<size_t, NUM_CLASSES> counts{};
+
+    // hand cached arrays back to the shared lists when the thread exits
+    ~thread_cache() {
+      bucket_pool& pool = instance();
+      std::lock_guard<std::mutex> lock(pool.mutex_);
+      for (size_t cls = 0; cls < NUM_CLASSES; ++cls) {
+        for (size_t i = 0; i < counts[cls]; ++i) {
+          pool.free_lists_[cls].push_back(blocks[cls][i]);
+        }
+      }
+    }
+  };
+
+  bucket_pool() = default;
+
+  static thread_cache& local_cache() {
+    static thread_local thread_cache cache;
+    return cache;
+  }
+
+  static size_t size_class(size_t bytes) {
+    return std::countr_zero(std::bit_ceil(std::max(bytes, min_block_size)));
+  }
+
+  static size_t block_size(size_t cls) { return size_t{1} << cls; }
+
+  static void* map_block(size_t bytes) {
+    void* p = MAP_FAILED;
+    if (bytes >= huge_page_size) {
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+      // no reserved huge pages, fall back to transparent huge pages
+      p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      if (bytes >= huge_page_size) {
+        madvise(p, bytes, MADV_HUGEPAGE);
+      }
+    }
+    return p;
+  }
+
+  std::mutex mutex_;
+  std::array<std::vector<void*>, NUM_CLASSES> free_lists_;
+};
+
+// Allocator drawing from bucket_pool, for use as the Allocator parameter of
+// cuckoo_table and cuckoo_set.
+template <typename T>
+struct pool_allocator {
+  using value_type = T;
+
+  pool_allocator() = default;
+  template <class U>
+  constexpr pool_allocator(const pool_allocator<U>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(bucket_pool::instance().allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    bucket_pool::instance().deallocate(p, n * sizeof(T));
+  }
+
+  // lets memory_usage() report huge pages for large arrays
+  static std::size_t page_size(std::size_t bytes) {
+    return bucket_pool::page_size(bytes);
+  }
+
+  bool operator==(const pool_allocator<T>&) const noexcept { return true; }
+};
+
+}  // namespace cuckoo
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <tuple>
+
+#include "cuckoo_set.hpp"
+#include "cuckoo_table.hpp"
+
+namespace cuckoo {
+
+// One table's share of a probe_many() call: its keys and where to write their
+// iterators.
+template <class Table>
+struct probe {
+  Table& table;
+  const KeyT* keys;
+  size_t num_keys;
+  typename Table::iterator* results;
+};
+
+template <class Table>
+probe(Table&, const KeyT*, size_t, typename Table::iterator*) -> probe<Table>;
+
+// Looks up a batch of keys in each of several cuckoo_table and cuckoo_set
+// instances. The buckets of every table are prefetched before any of them is
+// searched, so the misses of all tables overlap instead of each table's
+// find_batched() stalling on its own. Longer batches are probed
+// MAX_LOOKUP_BATCH_SZ keys at a time, the most a batch_state holds.
+template <class... Tables>
+void probe_many(probe<Tables>... probes) {
+  size_t num_keys = std::max({probes.num_keys...});
+  for (size_t base = 0; base < num_keys; base += MAX_LOOKUP_BATCH_SZ) {
+    // a table with fewer keys sits out the remaining chunks
+    auto begin = [base](const auto& p) { return std::min(base, p.num_keys); };
+    auto count = [&](const auto& p) {
+      return std::min(p.num_keys - begin(p), MAX_LOOKUP_BATCH_SZ);
+    };
+
+    std::tuple<typename Tables::batch_state...> states;
+    std::apply(
+        [&](auto&... state) {
+          (probes.table.prefetch_batched(probes.keys + begin(probes),
+                                         count(probes), state),
+           ...);
+          (probes.table.search_batched(probes.keys + begin(probes),
+                                       count(probes), state,
+                                       probes.results + begin(probes)),
+           ...);
+        },
+        states);
+  }
+}
+
+}  // namespace cuckoo
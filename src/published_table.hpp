@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cuckoo {
+
+// Holds the current version of a read-only table for lock-free readers, in
+// the style of RCU. A writer builds the next version offline and publishes
+// it with one atomic store, and the version it replaced is freed once every
+// reader that could have seen it has moved on.
+//
+// Reclamation is epoch based. A reader announces the epoch it entered in its
+// own cache line, and a retired version is freed once no announcement is
+// older than the epoch it was retired in. Readers only ever write their own
+// line; the shared pointer and epoch are written by publish() alone.
+//
+// Each reader thread registers once and reads through the guards its handle
+// hands out. Published tables must not be modified, beyond calls such as
+// find() that leave their contents alone.
+template <class Table, size_t MaxReaders = 64>
+class published_table {
+ public:
+  // Keeps a version in use for as long as it lives.
+  class guard {
+   public:
+    guard(const guard&) = delete;
+    guard& operator=(const guard&) = delete;
+
+    ~guard() { announced_.store(IDLE_EPOCH, std::memory_order_release); }
+
+    Table& operator*() const { return *table_; }
+    Table* operator->() const { return table_; }
+
+   private:
+    friend class published_table;
+
+    guard(std::atomic<uint64_t>& announced, Table* table)
+        : announced_(announced), table_(table) {}
+
+    std::atomic<uint64_t>& announced_;
+    Table* table_;
+  };
+
+  class reader {
+   public:
+    reader(reader&& other) noexcept
+        : owner_(std::exchange(other.owner_, nullptr)),
+          slot_idx_(other.slot_idx_) {}
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+    reader& operator=(reader&&) = delete;
+
+    ~reader() {
+      if (owner_) {
+        owner_->slots_[slot_idx_].in_use.store(false,
+                                               std::memory_order_release);
+      }
+    }
+
+    // Returns the current version. A reader may hold one guard at a time.
+    guard read() {
+      slot& s = owner_->slots_[slot_idx_];
+      s.epoch.store(owner_->epoch_.load(std::memory_order_acquire),
+                    std::memory_order_relaxed);
+      // the announcement must be visible before the pointer is read, or a
+      // writer could free the version read below without seeing it
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return guard(s.epoch, owner_->current_.load(std::memory_order_acquire));
+    }
+
+   private:
+    friend class published_table;
+
+    reader(published_table* owner, size_t slot_idx)
+        : owner_(owner), slot_idx_(slot_idx) {}
+
+    published_table* owner_;
+    size_t slot_idx_;
+  };
+
+  explicit published_table(std::unique_ptr<Table> initial)
+      : current_(initial.release()) {
+    if (!current_.load(std::memory_order_relaxed)) {
+      throw std::invalid_argument("initial table is null");
+    }
+  }
+
+  published_table(const published_table&) = delete;
+  published_table& operator=(const published_table&) = delete;
+
+  // Readers must be gone by now.
+  ~published_table() { delete current_.load(std::memory_order_relaxed); }
+
+  // Claims a slot for the calling thread until the handle is destroyed.
+  // Throws if all MaxReaders slots are taken.
+  reader register_reader() {
+    for (size_t i = 0; i < MaxReaders; ++i) {
+      bool expected = false;
+      if (slots_[i].in_use.compare_exchange_strong(
+              expected, true, std::memory_order_acquire)) {
+        return reader(this, i);
+      }
+    }
+    throw std::runtime_error{"no free reader slot"};
+  }
+
+  // Makes `next` the version new guards see, then frees the retired versions
+  // no reader can still hold. Writers are serialized against each other.
+  void publish(std::unique_ptr<Table> next) {
+    if (!next) {
+      throw std::invalid_argument("published table is null");
+    }
+
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    Table* prev = current_.exchange(next.release(), std::memory_order_acq_rel);
+    // readers that enter from this epoch on see `next`
+    uint64_t epoch = epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    retired_.emplace_back(prev, epoch);
+    reclaim_locked();
+  }
+
+  // Frees the retired versions that no reader can still hold, e.g. once
+  // readers that were slow to leave have left. Returns how many remain.
+  size_t reclaim() {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    reclaim_locked();
+    return retired_.size();
+  }
+
+ private:
+  static constexpr uint64_t IDLE_EPOCH = std::numeric_limits<uint64_t>::max();
+
+  struct alignas(64) slot {
+    std::atomic<bool> in_use{false};
+    // epoch the reader entered in, or IDLE_EPOCH outside of a guard
+    std::atomic<uint64_t> epoch{IDLE_EPOCH};
+  };
+
+  struct retired_table {
+    retired_table(Table* table, uint64_t epoch) : table(table), epoch(epoch) {}
+
+    std::unique_ptr<Table> table;
+    // the first epoch in which readers can no longer see it
+    uint64_t epoch;
+  };
+
+  void reclaim_locked() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_epoch = IDLE_EPOCH;
+    for (const slot& s : slots_) {
+      min_epoch = std::min(min_epoch, s.epoch.load(std::memory_order_acquire));
+    }
+    std::erase_if(retired_, [min_epoch](const retired_table& retired) {
+      return retired.epoch <= min_epoch;
+    });
+  }
+
+  // read by every reader, written only by publish()
+  alignas(64) std::atomic<Table*> current_;
+  std::atomic<uint64_t> epoch_{1};
+
+  alignas(64) std::mutex writer_mutex_;
+  std::vector<retired_table> retired_;
+
+  std::array<slot, MaxReaders> slots_;
+};
+
+}  // namespace cuckoo
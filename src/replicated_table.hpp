@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cuckoo_table.hpp"
+#include "numa.hpp"
+
+namespace cuckoo {
+
+// Read-only copies of a cuckoo_table, one per NUMA node, each in huge pages
+// bound to its node. Lookups go to the replica of the node the calling thread
+// runs on, so that find_batched() on a multi-socket host reads local DRAM
+// instead of crossing the interconnect for about half of its buckets.
+//
+// The replicas are cloned from a source table when the holder is built and
+// are not updated after; rebuild the holder, e.g. behind a published_table,
+// to pick up writes. On a single-node machine there is one replica.
+template <class Hash = std::hash<KeyT>>
+class replicated_table {
+ public:
+  using table_type = cuckoo_table<Hash, numa_allocator<Bucket>>;
+  using iterator = Bucket::iterator;
+
+  explicit replicated_table(table_type& source) {
+    size_t num_nodes = numa::num_nodes();
+    replicas_.reserve(num_nodes);
+    for (size_t node = 0; node < num_nodes; ++node) {
+      replicas_.push_back(
+          source.clone(numa_allocator<Bucket>(static_cast<int>(node))));
+    }
+  }
+
+  size_t num_replicas() const { return replicas_.size(); }
+
+  table_type& replica(size_t node) { return replicas_[node]; }
+
+  // The calling thread's replica. Its node is looked up again every
+  // NODE_REFRESH_PERIOD calls, so a thread that migrates soon reads locally
+  // again.
+  table_type& local() {
+    static thread_local size_t node = 0;
+    static thread_local size_t countdown = 0;
+    if (countdown == 0) {
+      node = numa::current_node();
+      countdown = NODE_REFRESH_PERIOD;
+    }
+    countdown--;
+    return replicas_[node < replicas_.size() ? node : 0];
+  }
+
+  iterator find(KeyT key) { return local().find(key); }
+
+  void find_batched(const KeyT* keys, size_t num_keys, iterator* results) {
+    local().find_batched(keys, num_keys, results);
+  }
+
+ private:
+  static constexpr size_t NODE_REFRESH_PERIOD = 4096;
+
+  std::vector<table_type> replicas_;
+};
+
+}  // namespace cuckoo
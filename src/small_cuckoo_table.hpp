@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+#include "fixed_cuckoo_table.hpp"
+
+namespace cuckoo {
+
+constexpr size_t MAX_SMALL_CAPACITY = 256;
+
+// A fixed_cuckoo_table small enough to be stack-allocated for tiny
+// per-request tables. Constructing one costs a memset of its bucket array,
+// at most 4 KiB.
+template <size_t Capacity, class Hash = std::hash<KeyT>>
+  requires(Capacity <= MAX_SMALL_CAPACITY)
+using small_cuckoo_table = fixed_cuckoo_table<Capacity, Hash>;
+
+}  // namespace cuckoo
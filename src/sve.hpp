@@ -0,0 +1,58 @@
+#pragma once
+
+// Vector-length-agnostic slot search for SVE targets, used by the bucket
+// kernels in place of NEON when the compiler targets SVE (e.g.
+// -march=armv8.2-a+sve, or -march=native on Graviton3). Each compare covers
+// svcntd() slots, so a 4-slot bucket is one compare on 256-bit vectors and
+// two on 128-bit ones, and wider buckets scale without code changes.
+#if defined(__ARM_FEATURE_SVE)
+
+#include <arm_sve.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cuckoo::sve {
+
+// Returns the index of the first of the `n` slots equal to `key`, or `n` if
+// there is none.
+inline size_t find_first(const uint64_t* slots, size_t n, uint64_t key) {
+  for (size_t i = 0; i < n; i += svcntd()) {
+    svbool_t pg = svwhilelt_b64(i, n);
+    svbool_t match = svcmpeq_n_u64(pg, svld1_u64(pg, slots + i), key);
+    if (svptest_any(pg, match)) {
+      // count the active lanes before the first match
+      return i + svcntp_b64(pg, svbrkb_b_z(pg, match));
+    }
+  }
+  return n;
+}
+
+// Searches two slot arrays of length N for `key`, returning an index in
+// [0, N) for a match in `a`, [N, 2N) for one in `b`, and 2N for none. When a
+// vector holds 2N slots, `b` is spliced in after `a` so that one compare and
+// one count of the lanes before the first match give the result. Otherwise
+// each array takes one compare and the result is picked with a select.
+// Neither path loops. Requires svcntd() >= N; callers fall back to NEON on
+// narrower vectors.
+template <size_t N>
+inline size_t find_first_pair(const uint64_t* a, const uint64_t* b,
+                              uint64_t key) {
+  const svbool_t pn = svwhilelt_b64(uint64_t{0}, uint64_t{N});
+  if (svcntd() >= 2 * N) {
+    // lanes [0, N) hold `a`, lanes [N, 2N) hold `b`
+    svuint64_t slots = svsplice_u64(pn, svld1_u64(pn, a), svld1_u64(pn, b));
+    const svbool_t p2n = svwhilelt_b64(uint64_t{0}, uint64_t{2 * N});
+    svbool_t match = svcmpeq_n_u64(p2n, slots, key);
+    return svcntp_b64(p2n, svbrkb_b_z(p2n, match));
+  }
+  svbool_t match_a = svcmpeq_n_u64(pn, svld1_u64(pn, a), key);
+  svbool_t match_b = svcmpeq_n_u64(pn, svld1_u64(pn, b), key);
+  size_t pos_a = svcntp_b64(pn, svbrkb_b_z(pn, match_a));
+  size_t pos_b = svcntp_b64(pn, svbrkb_b_z(pn, match_b));
+  return pos_a < N ? pos_a : N + pos_b;
+}
+
+}  // namespace cuckoo::sve
+
+#endif  // __ARM_FEATURE_SVE
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sizing and bucket addressing shared by the cuckoo tables and sets.
+namespace cuckoo::detail {
+
+// Bucket arrays are a power of two long, so that a bucket id is the hash
+// masked with `bucket_mask`, the array length minus one.
+constexpr uint64_t next_pow2(uint64_t x) {
+  x--;
+  x |= (x >> 1);
+  x |= (x >> 2);
+  x |= (x >> 4);
+  x |= (x >> 8);
+  x |= (x >> 16);
+  x |= (x >> 32);
+  x++;
+  return x;
+}
+
+// A key lives in one of two buckets: its primary bucket, picked by the low
+// bits of its hash `h`, or its alternate, picked by rehashing `h` mixed with
+// the key. Keys that share a primary bucket thus spread over different
+// alternates, and a displaced key's other bucket is found from the key alone.
+constexpr size_t primary_bucket_id(size_t h, size_t bucket_mask) {
+  return h & bucket_mask;
+}
+
+template <class Hash, class KeyT>
+constexpr size_t alternate_bucket_id(const Hash& hash_fn, size_t h, KeyT key,
+                                     size_t bucket_mask) {
+  return hash_fn(h ^ key) & bucket_mask;
+}
+
+// parallel_for() hands each thread at least this much of a bucket array to
+// copy or reset. At memory bandwidth 4 MiB takes on the order of a
+// millisecond, which dwarfs the cost of spawning the thread, and arrays
+// smaller than that are handled by the calling thread alone.
+constexpr size_t PARALLEL_MIN_BYTES = size_t{4} << 20;
+
+template <class Bucket>
+constexpr size_t parallel_min_buckets() {
+  return PARALLEL_MIN_BYTES / sizeof(Bucket);
+}
+
+}  // namespace cuckoo::detail
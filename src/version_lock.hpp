@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace cuckoo {
+
+inline void cpu_relax() {
+#if defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// A writer spinlock that doubles as a version counter for optimistic
+// readers, in the style of a seqlock. The version is odd while a writer holds
+// the lock and changes on every unlock, so a reader that saw the same even
+// version before and after reading knows no write overlapped its reads.
+// Padded to a cache line so that neighbouring locks do not share one.
+class alignas(64) version_lock {
+ public:
+  void lock() {
+    uint64_t v = version_.load(std::memory_order_relaxed);
+    while ((v & 1) || !version_.compare_exchange_weak(
+                          v, v + 1, std::memory_order_acquire,
+                          std::memory_order_relaxed)) {
+      cpu_relax();
+      v = version_.load(std::memory_order_relaxed);
+    }
+    // keep the protected writes from becoming visible before the odd version
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void unlock() {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+  // Waits out any writer and returns the version to validate against.
+  uint64_t read_begin() const {
+    uint64_t v = version_.load(std::memory_order_acquire);
+    while (v & 1) {
+      cpu_relax();
+      v = version_.load(std::memory_order_acquire);
+    }
+    return v;
+  }
+
+  // Returns whether no writer has held the lock since read_begin() returned
+  // `v`, i.e. whether the reads in between can be trusted.
+  bool read_validate(uint64_t v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == v;
+  }
+
+ private:
+  std::atomic<uint64_t> version_{0};
+};
+
+}  // namespace cuckoo
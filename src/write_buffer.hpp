@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+
+#include "concurrent_cuckoo_table.hpp"
+
+namespace cuckoo {
+
+// Collects one thread's inserts and erases to a concurrent_cuckoo_table and
+// applies them with write_batched() once BufferSz of them have built up, on
+// flush(), and on destruction. That takes each stripe lock once per flush
+// instead of once per write, with the buckets prefetched.
+//
+// Other threads do not see buffered writes until they are flushed, so they
+// lag behind each writer by at most BufferSz writes. The owning thread reads
+// its own writes through find(), which replays the buffer over the table. As
+// with write_batched(), an insert of a key that exists when it is flushed is
+// dropped. If a flush throws, the writes it did not apply stay buffered and
+// the next flush retries them. Not thread-safe: give each writer thread its
+// own buffer.
+template <class Table, size_t BufferSz = 64>
+class write_buffer {
+ public:
+  using write_op = typename Table::write_op;
+
+  explicit write_buffer(Table& table) : table_(table) {}
+
+  write_buffer(const write_buffer&) = delete;
+  write_buffer& operator=(const write_buffer&) = delete;
+
+  // Flushes what is left, dropping writes that still fail; call flush()
+  // first to see insertion failures.
+  ~write_buffer() {
+    try {
+      flush();
+    } catch (const std::runtime_error&) {
+    }
+  }
+
+  // Throw std::invalid_argument for NULL_KEY rather than buffer a write
+  // that no flush could apply.
+  void insert(KeyT key, ValueT value) {
+    push({write_op::Type::insert, key, value});
+  }
+
+  void erase(KeyT key) { push({write_op::Type::erase, key}); }
+
+  // Replays the buffered writes to `key` in order, as flush() would apply
+  // them to the table as it is now: an insert only takes effect if the key
+  // is absent at that point. The table is only searched if an insert needs
+  // to know.
+  std::optional<ValueT> find(KeyT key) {
+    std::optional<ValueT> value;
+    bool known = false;
+    for (size_t i = 0; i < num_ops_; ++i) {
+      if (ops_[i].key != key) {
+        continue;
+      }
+      if (ops_[i].type == write_op::Type::erase) {
+        value.reset();
+      } else {
+        if (!known) {
+          value = table_.find(key);
+        }
+        if (!value) {
+          value = ops_[i].value;
+        }
+      }
+      known = true;
+    }
+    return known ? value : table_.find(key);
+  }
+
+  // On a throw, keeps the writes that were not applied, in order.
+  void flush() {
+    try {
+      table_.write_batched(ops_.data(), num_ops_);
+    } catch (...) {
+      size_t num_left = 0;
+      for (size_t i = 0; i < num_ops_; ++i) {
+        if (!ops_[i].applied) {
+          ops_[num_left++] = ops_[i];
+        }
+      }
+      num_ops_ = num_left;
+      throw;
+    }
+    num_ops_ = 0;
+  }
+
+  size_t size() const { return num_ops_; }
+
+ private:
+  void push(const write_op& op) {
+    if (op.key == NULL_KEY) {
+      throw std::invalid_argument{"NULL_KEY is reserved for empty slots"};
+    }
+    // still full after a failed flush
+    if (num_ops_ == BufferSz) {
+      flush();
+    }
+    ops_[num_ops_++] = op;
+    if (num_ops_ == BufferSz) {
+      flush();
+    }
+  }
+
+  Table& table_;
+  std::array<write_op, BufferSz> ops_;
+  size_t num_ops_{0};
+};
+
+}  // namespace cuckoo
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cuckoo {
+
+// Marsaglia's xorshift64, used to pick eviction victims and which keys to
+// sample. Each table owns one for its evictions, so concurrent inserts into
+// different tables share no state, and unlike a round-robin counter its
+// sequence does not fall into step with a cycle of buckets in the
+// displacement chain.
+class xorshift64 {
+ public:
+  explicit constexpr xorshift64(uint64_t seed = 0x9e3779b97f4a7c15)
+      : state_(seed ? seed : 1) {}
+
+  constexpr uint64_t operator()() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+}  // namespace cuckoo
@@ -2,13 +2,22 @@
 #include <chrono>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <thread>
 #include <vector>
 
+#include "concurrent_cuckoo_set.hpp"
+#include "concurrent_cuckoo_table.hpp"
 #include "cuckoo_set.hpp"
+#include "cuckoo_table.hpp"
+#include "fixed_cuckoo_table.hpp"
+#include "flat_combining.hpp"
 #include "hash.hpp"
 #include "huge_page_allocator.hpp"
+#include "published_table.hpp"
+#include "replicated_table.hpp"
+#include "write_buffer.hpp"
 
 constexpr size_t CAPACITY = 128 * 1024 * 1024;
 constexpr size_t LOAD_PERCENTAGE = 80;
@@ -18,9 +27,28 @@ constexpr size_t NUM_KEYS = CAPACITY * LOAD_PERCENTAGE / 100;
 
 constexpr size_t NUM_WORKERS = 2;
 
+// L2-resident table for comparing against the compile-time sized variant
+constexpr size_t FIXED_CAPACITY = 32 * 1024;
+constexpr size_t NUM_FIXED_KEYS = FIXED_CAPACITY * LOAD_PERCENTAGE / 100;
+constexpr size_t NUM_FIXED_READ_KEYS =
+    FIXED_CAPACITY * LOAD_PERCENTAGE / HIT_PERCENTAGE;
+
+// shared table written by every worker at once
+constexpr size_t CONCURRENT_CAPACITY = 16 * 1024 * 1024;
+constexpr size_t NUM_CONCURRENT_KEYS =
+    CONCURRENT_CAPACITY * LOAD_PERCENTAGE / 100;
+
 using HugeVecT = std::vector<size_t, huge_page_allocator<size_t>>;
 using CuckooTableT = cuckoo_set::cuckoo_set<CRCHash<uint64_t>, huge_page_allocator<cuckoo_set::Bucket>>;
 
+void print_memory_usage(const char* name,
+                        const cuckoo::memory_usage_info& usage) {
+  std::cout << name << " memory: " << usage.bytes_allocated << "B allocated, "
+            << usage.bytes_resident << "B resident, " << usage.page_size
+            << "B pages, " << usage.num_buckets << " buckets, "
+            << usage.slot_efficiency * 100 << "% slot efficiency" << std::endl;
+}
+
 void run_test(const HugeVecT& read_idxs) {
   using cuckoo_set::MAX_LOOKUP_BATCH_SZ;
 
@@ -35,6 +63,7 @@ void run_test(const HugeVecT& read_idxs) {
     assert(!it.is_null());
   }
   assert(table.size() == NUM_KEYS);
+  print_memory_usage("cuckoo_set", table.memory_usage());
 
   std::array<size_t, NUM_WORKERS + 1> slices{0};
   for (size_t i = 1; i < NUM_WORKERS; ++i) {
@@ -91,6 +120,306 @@ void run_test(const HugeVecT& read_idxs) {
   assert(table.size() == 0);
 }
 
+template <class TableT>
+void run_lookups(TableT& table, const HugeVecT& read_idxs, const char* name) {
+  using cuckoo::MAX_LOOKUP_BATCH_SZ;
+
+  std::array<cuckoo::Bucket::iterator, MAX_LOOKUP_BATCH_SZ> results{};
+  std::array<cuckoo::KeyT, MAX_LOOKUP_BATCH_SZ> keys{};
+  size_t num_hits = 0;
+
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < NUM_REQUESTS; i += MAX_LOOKUP_BATCH_SZ) {
+    for (size_t j = 0; j < MAX_LOOKUP_BATCH_SZ; ++j) {
+      keys[j] = read_idxs[i + j] % NUM_FIXED_READ_KEYS;
+    }
+    table.find_batched(keys.data(), MAX_LOOKUP_BATCH_SZ, results.data());
+    for (auto& it : results) {
+      num_hits += !it.is_null();
+    }
+  }
+
+  std::chrono::steady_clock::time_point finish = std::chrono::steady_clock::now();
+
+  auto elapsed_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(finish - begin)
+          .count();
+  double throughput = static_cast<double>(NUM_REQUESTS) / (elapsed_us / 1e6);
+
+  std::cout << name << " lookup throughput: " << throughput
+            << " (hits: " << num_hits << ")" << std::endl;
+}
+
+void run_fixed_test(const HugeVecT& read_idxs) {
+  using TableT = cuckoo::cuckoo_table<CRCHash<uint64_t>>;
+  using FixedTableT = cuckoo::fixed_cuckoo_table<FIXED_CAPACITY, CRCHash<uint64_t>>;
+
+  TableT table(FIXED_CAPACITY);
+  auto fixed_table = std::make_unique<FixedTableT>();
+  for (size_t i = 0; i < NUM_FIXED_KEYS; ++i) {
+    table.insert(i, i);
+    fixed_table->insert(i, i);
+  }
+  assert(table.size() == NUM_FIXED_KEYS);
+  print_memory_usage("cuckoo_table (L2-resident)", table.memory_usage());
+  assert(fixed_table->size() == NUM_FIXED_KEYS);
+
+  run_lookups(table, read_idxs, "cuckoo_table (L2-resident)");
+  run_lookups(*fixed_table, read_idxs, "fixed_cuckoo_table (L2-resident)");
+}
+
+double elapsed_s(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - begin)
+             .count() /
+         1e6;
+}
+
+using ConcurrentTableT = cuckoo::concurrent_cuckoo_table<
+    CRCHash<uint64_t>, huge_page_allocator<cuckoo::Bucket>>;
+
+// Runs `insert_keys(worker_idx)` on every worker at once, each inserting an
+// interleaved share of the keys so that they contend on the same stripes.
+template <class Fn>
+void run_concurrent_inserts(ConcurrentTableT& table, const char* name,
+                            Fn&& insert_keys) {
+  std::array<std::thread, NUM_WORKERS> workers;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread(insert_keys, w);
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  table.wait_for_relocations();
+  std::cout << name << " insert throughput: "
+            << NUM_CONCURRENT_KEYS / elapsed_s(begin) << std::endl;
+  assert(table.size() == NUM_CONCURRENT_KEYS);
+}
+
+void run_concurrent_test(const HugeVecT& read_idxs) {
+  using cuckoo::MAX_LOOKUP_BATCH_SZ;
+
+  ConcurrentTableT table(CONCURRENT_CAPACITY);
+  run_concurrent_inserts(table, "concurrent_cuckoo_table", [&](size_t w) {
+    for (size_t i = w; i < NUM_CONCURRENT_KEYS; i += NUM_WORKERS) {
+      table.insert(i, i);
+    }
+  });
+
+  std::array<std::thread, NUM_WORKERS> workers;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread([&table, &read_idxs, w] {
+      std::array<std::optional<cuckoo::ValueT>, MAX_LOOKUP_BATCH_SZ> results;
+      std::array<cuckoo::KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+      size_t start = w * NUM_REQUESTS / NUM_WORKERS;
+      size_t end = (w + 1) * NUM_REQUESTS / NUM_WORKERS;
+      for (size_t i = start; i + MAX_LOOKUP_BATCH_SZ <= end;
+           i += MAX_LOOKUP_BATCH_SZ) {
+        for (size_t j = 0; j < MAX_LOOKUP_BATCH_SZ; ++j) {
+          keys[j] = read_idxs[i + j] % CONCURRENT_CAPACITY;
+        }
+        table.find_batched(keys.data(), MAX_LOOKUP_BATCH_SZ, results.data());
+      }
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  std::cout << "concurrent_cuckoo_table lookup throughput: "
+            << NUM_REQUESTS / elapsed_s(begin) << std::endl;
+}
+
+// Deduplicates a stream that every worker sees in full, so that each key is
+// inserted by all of them at once and exactly one insert per key succeeds.
+void run_concurrent_set_test(const HugeVecT& read_idxs) {
+  using cuckoo_set::MAX_LOOKUP_BATCH_SZ;
+  using ConcurrentSetT = cuckoo_set::concurrent_cuckoo_set<
+      CRCHash<uint64_t>, huge_page_allocator<cuckoo_set::Bucket>>;
+
+  ConcurrentSetT set(CONCURRENT_CAPACITY);
+  std::atomic<size_t> num_added = 0;
+  std::array<std::thread, NUM_WORKERS> workers;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread([&, w] {
+      size_t offset = w * NUM_CONCURRENT_KEYS / NUM_WORKERS;
+      size_t added = 0;
+      for (size_t i = 0; i < NUM_CONCURRENT_KEYS; ++i) {
+        added += set.insert((offset + i) % NUM_CONCURRENT_KEYS);
+      }
+      num_added += added;
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  std::cout << "concurrent_cuckoo_set insert throughput: "
+            << NUM_WORKERS * NUM_CONCURRENT_KEYS / elapsed_s(begin)
+            << std::endl;
+  assert(num_added == NUM_CONCURRENT_KEYS);
+  assert(set.size() == NUM_CONCURRENT_KEYS);
+
+  begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread([&set, &read_idxs, w] {
+      std::array<bool, MAX_LOOKUP_BATCH_SZ> results;
+      std::array<cuckoo_set::KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+      size_t start = w * NUM_REQUESTS / NUM_WORKERS;
+      size_t end = (w + 1) * NUM_REQUESTS / NUM_WORKERS;
+      for (size_t i = start; i + MAX_LOOKUP_BATCH_SZ <= end;
+           i += MAX_LOOKUP_BATCH_SZ) {
+        for (size_t j = 0; j < MAX_LOOKUP_BATCH_SZ; ++j) {
+          keys[j] = read_idxs[i + j] % CONCURRENT_CAPACITY;
+        }
+        set.contains_batched(keys.data(), MAX_LOOKUP_BATCH_SZ, results.data());
+      }
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  std::cout << "concurrent_cuckoo_set lookup throughput: "
+            << NUM_REQUESTS / elapsed_s(begin) << std::endl;
+}
+
+// Serves lookups from a published L2-resident table while the main thread
+// keeps rebuilding it offline and swapping the new version in.
+void run_published_test(const HugeVecT& read_idxs) {
+  using cuckoo::MAX_LOOKUP_BATCH_SZ;
+  using TableT = cuckoo::cuckoo_table<CRCHash<uint64_t>>;
+
+  auto build = [] {
+    auto table = std::make_unique<TableT>(FIXED_CAPACITY);
+    for (size_t i = 0; i < NUM_FIXED_KEYS; ++i) {
+      table->insert(i, i);
+    }
+    return table;
+  };
+  cuckoo::published_table<TableT> published(build());
+
+  std::atomic<size_t> num_running = NUM_WORKERS;
+  std::array<std::thread, NUM_WORKERS> workers;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread([&, w] {
+      auto reader = published.register_reader();
+      std::array<cuckoo::Bucket::iterator, MAX_LOOKUP_BATCH_SZ> results{};
+      std::array<cuckoo::KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+      size_t start = w * NUM_REQUESTS / NUM_WORKERS;
+      size_t end = (w + 1) * NUM_REQUESTS / NUM_WORKERS;
+      for (size_t i = start; i + MAX_LOOKUP_BATCH_SZ <= end;
+           i += MAX_LOOKUP_BATCH_SZ) {
+        for (size_t j = 0; j < MAX_LOOKUP_BATCH_SZ; ++j) {
+          keys[j] = read_idxs[i + j] % NUM_FIXED_READ_KEYS;
+        }
+        auto table = reader.read();
+        table->find_batched(keys.data(), MAX_LOOKUP_BATCH_SZ, results.data());
+      }
+      num_running--;
+    });
+  }
+
+  size_t num_publishes = 0;
+  while (num_running.load() > 0) {
+    published.publish(build());
+    num_publishes++;
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  std::cout << "published_table lookup throughput: "
+            << NUM_REQUESTS / elapsed_s(begin) << " (" << num_publishes
+            << " publishes)" << std::endl;
+  assert(published.reclaim() == 0);
+}
+
+// Times lookups with worker w bound to node w % num_nodes and reading the
+// table `table_for(node)` returns for its node.
+template <class Fn>
+void run_numa_lookups(const HugeVecT& read_idxs, const char* name,
+                      Fn&& table_for) {
+  using cuckoo::MAX_LOOKUP_BATCH_SZ;
+
+  size_t num_nodes = cuckoo::numa::num_nodes();
+  std::array<std::thread, NUM_WORKERS> workers;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (size_t w = 0; w < NUM_WORKERS; ++w) {
+    workers[w] = std::thread([&, w] {
+      size_t node = w % num_nodes;
+      cuckoo::numa::bind_thread(node);
+      auto& table = table_for(node);
+      std::array<cuckoo::Bucket::iterator, MAX_LOOKUP_BATCH_SZ> results{};
+      std::array<cuckoo::KeyT, MAX_LOOKUP_BATCH_SZ> keys;
+      size_t start = w * NUM_REQUESTS / NUM_WORKERS;
+      size_t end = (w + 1) * NUM_REQUESTS / NUM_WORKERS;
+      for (size_t i = start; i + MAX_LOOKUP_BATCH_SZ <= end;
+           i += MAX_LOOKUP_BATCH_SZ) {
+        for (size_t j = 0; j < MAX_LOOKUP_BATCH_SZ; ++j) {
+          keys[j] = read_idxs[i + j] % CONCURRENT_CAPACITY;
+        }
+        table.find_batched(keys.data(), MAX_LOOKUP_BATCH_SZ, results.data());
+      }
+    });
+  }
+  for (auto& t : workers) {
+    t.join();
+  }
+  std::cout << name << " lookup throughput: "
+            << NUM_REQUESTS / elapsed_s(begin) << std::endl;
+}
+
+// Compares a table interleaved across NUMA nodes with per-node replicas read
+// locally and read from the next node over. With a single node, all three
+// read the same local memory.
+void run_numa_test(const HugeVecT& read_idxs) {
+  using ReplicatedT = cuckoo::replicated_table<CRCHash<uint64_t>>;
+
+  ReplicatedT::table_type interleaved(CONCURRENT_CAPACITY,
+                                      cuckoo::numa_allocator<cuckoo::Bucket>());
+  for (size_t i = 0; i < NUM_CONCURRENT_KEYS; ++i) {
+    interleaved.insert(i, i);
+  }
+  ReplicatedT replicated(interleaved);
+  size_t num_replicas = replicated.num_replicas();
+  std::cout << "replicated_table: " << num_replicas << " node(s)" << std::endl;
+
+  run_numa_lookups(read_idxs, "interleaved cuckoo_table",
+                   [&](size_t) -> auto& { return interleaved; });
+  run_numa_lookups(read_idxs, "replicated_table (local)",
+                   [&](size_t) -> auto& { return replicated; });
+  run_numa_lookups(read_idxs, "replicated_table (remote)",
+                   [&](size_t node) -> auto& {
+                     return replicated.replica((node + 1) % num_replicas);
+                   });
+}
+
+// Compares ways of funneling the same concurrent inserts into a shared table.
+void run_combined_insert_test() {
+  {
+    ConcurrentTableT table(CONCURRENT_CAPACITY);
+    run_concurrent_inserts(table, "write_buffer", [&](size_t w) {
+      cuckoo::write_buffer<ConcurrentTableT> buffer(table);
+      for (size_t i = w; i < NUM_CONCURRENT_KEYS; i += NUM_WORKERS) {
+        buffer.insert(i, i);
+      }
+      buffer.flush();
+    });
+  }
+  {
+    ConcurrentTableT table(CONCURRENT_CAPACITY);
+    cuckoo::flat_combining_table<ConcurrentTableT> combining(table);
+    run_concurrent_inserts(table, "flat_combining_table", [&](size_t w) {
+      auto handle = combining.register_thread();
+      for (size_t i = w; i < NUM_CONCURRENT_KEYS; i += NUM_WORKERS) {
+        handle.insert(i, i);
+      }
+    });
+  }
+}
+
 int main() {
   // generate random lookups
   std::random_device rd{};
@@ -103,4 +432,10 @@ int main() {
   }
 
   run_test(read_idxs);
+  run_fixed_test(read_idxs);
+  run_concurrent_test(read_idxs);
+  run_concurrent_set_test(read_idxs);
+  run_published_test(read_idxs);
+  run_numa_test(read_idxs);
+  run_combined_insert_test();
 }
@@ -0,0 +1,1405 @@
+// Behavior checks for the tables. Unlike the asserts in main.cpp, CHECK stays
+// on in Release builds, so these run in the configuration the README builds.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "adaptive.hpp"
+#include "concurrent_cuckoo_set.hpp"
+#include "concurrent_cuckoo_table.hpp"
+#include "cuckoo_set.hpp"
+#include "cuckoo_table.hpp"
+#include "fixed_cuckoo_table.hpp"
+#include "flat_combining.hpp"
+#include "flow_table.hpp"
+#include "front_cache.hpp"
+#include "hash.hpp"
+#include "pool_allocator.hpp"
+#include "probe_many.hpp"
+#include "resp.hpp"
+#include "small_cuckoo_table.hpp"
+#include "write_buffer.hpp"
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond         \
+                << ") failed" << std::endl;                                \
+      std::abort();                                                        \
+    }                                                                      \
+  } while (0)
+
+#define CHECK_THROWS(expr, exception)                                      \
+  do {                                                                     \
+    bool thrown = false;                                                   \
+    try {                                                                  \
+      expr;                                                                \
+    } catch (const exception&) {                                           \
+      thrown = true;                                                       \
+    }                                                                      \
+    if (!thrown) {                                                         \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #expr               \
+                << " did not throw " #exception << std::endl;              \
+      std::abort();                                                        \
+    }                                                                      \
+  } while (0)
+
+namespace {
+
+using TableT = cuckoo::cuckoo_table<CRCHash<uint64_t>>;
+
+// Cache-aligned bucket arrays, as cuckoo_set requires, without the reserved
+// huge pages that huge_page_allocator needs.
+template <class T>
+struct aligned_allocator {
+  using value_type = T;
+
+  aligned_allocator() = default;
+  template <class U>
+  aligned_allocator(const aligned_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(::operator new(n * sizeof(T), ALIGNMENT));
+  }
+
+  void deallocate(T* p, size_t) { ::operator delete(p, ALIGNMENT); }
+
+  bool operator==(const aligned_allocator&) const { return true; }
+
+  static constexpr std::align_val_t ALIGNMENT{
+      cuckoo::hardware_constructive_interference_size};
+};
+
+using SetT = cuckoo_set::cuckoo_set<CRCHash<uint64_t>,
+                                    aligned_allocator<cuckoo_set::Bucket>>;
+
+cuckoo::Bucket empty_bucket() {
+  cuckoo::Bucket bucket;
+  for (size_t i = 0; i < cuckoo::SLOTS_PER_BUCKET; ++i) {
+    bucket.erase(i);
+  }
+  return bucket;
+}
+
+std::vector<cuckoo::KvT> entries(TableT& table) {
+  std::vector<cuckoo::KvT> result;
+  table.for_each([&](cuckoo::KeyT key, cuckoo::ValueT value) {
+    result.emplace_back(key, value);
+  });
+  return result;
+}
+
+void test_reserved_key() {
+  TableT table(64);
+  CHECK_THROWS(table.insert(cuckoo::NULL_KEY, 1), std::invalid_argument);
+  TableT::Op op{TableT::Op::Type::upsert, cuckoo::NULL_KEY, 1};
+  CHECK_THROWS(table.execute_batch(&op, 1), std::invalid_argument);
+  CHECK(table.size() == 0);
+
+  SetT set(64);
+  CHECK_THROWS(set.insert(cuckoo_set::NULL_KEY), std::invalid_argument);
+  CHECK(set.size() == 0);
+
+  cuckoo::fixed_cuckoo_table<64, CRCHash<uint64_t>> fixed;
+  CHECK_THROWS(fixed.insert(cuckoo::NULL_KEY, 1), std::invalid_argument);
+  CHECK(fixed.size() == 0);
+}
+
+// Reserved keys would match free and erased slots, so every operation
+// rejects them.
+void test_concurrent_set_reserved_keys() {
+  cuckoo_set::concurrent_cuckoo_set<CRCHash<uint64_t>> set(64);
+  CHECK_THROWS(set.insert(cuckoo_set::NULL_KEY), std::invalid_argument);
+  CHECK_THROWS(set.insert(set.TOMB_KEY), std::invalid_argument);
+  CHECK(set.insert(1));
+  for (cuckoo_set::KeyT key : {cuckoo_set::NULL_KEY, set.TOMB_KEY}) {
+    CHECK_THROWS(set.erase(key), std::invalid_argument);
+    CHECK_THROWS(set.contains(key), std::invalid_argument);
+    bool found;
+    CHECK_THROWS(set.contains_batched(&key, 1, &found), std::invalid_argument);
+  }
+  CHECK(set.size() == 1 && set.erase(1));
+  CHECK(set.size() == 0);
+}
+
+void test_execute_batch() {
+  using Type = TableT::Op::Type;
+  TableT table(1024);
+
+  // longer than one prefetch batch, with ops on the same key spread across
+  // batch boundaries
+  std::vector<TableT::Op> ops;
+  for (cuckoo::KeyT k = 1; k <= 20; ++k) {
+    ops.push_back({Type::insert, k, k * 10});
+  }
+  ops.push_back({Type::find, 5});
+  ops.push_back({Type::upsert, 5, 555});
+  ops.push_back({Type::insert, 5, 1});
+  ops.push_back({Type::erase, 6});
+  ops.push_back({Type::find, 6});
+  ops.push_back({Type::erase, 6});
+  ops.push_back({Type::upsert, 100, 1000});
+  ops.push_back({Type::find, 100});
+  ops.push_back({Type::insert, 6, 66});
+  table.execute_batch(ops.data(), ops.size());
+
+  for (size_t i = 0; i < 20; ++i) {
+    CHECK(!ops[i].found);
+  }
+  CHECK(ops[20].found && ops[20].result.key() == 5);
+  CHECK(ops[21].found);
+  CHECK(ops[22].found);
+  CHECK(ops[23].found);
+  CHECK(!ops[24].found && ops[24].result.is_null());
+  CHECK(!ops[25].found);
+  CHECK(!ops[26].found);
+  CHECK(ops[27].found && ops[27].result.value() == 1000);
+  CHECK(!ops[28].found);
+
+  CHECK(table.size() == 21);
+  CHECK(table.find(5).value() == 555);
+  CHECK(table.find(6).value() == 66);
+  CHECK(table.find(100).value() == 1000);
+  for (cuckoo::KeyT k = 7; k <= 20; ++k) {
+    CHECK(table.find(k).value() == k * 10);
+  }
+}
+
+void test_find_batched_deref() {
+  struct record {
+    cuckoo::KeyT key;
+  };
+  std::vector<record> records(100);
+  TableT table(256);
+  for (cuckoo::KeyT k = 0; k < records.size(); k += 2) {
+    records[k].key = k;
+    table.insert(k, reinterpret_cast<uintptr_t>(&records[k]));
+  }
+
+  // not a multiple of the batch size, and too short to fill the pipeline
+  for (size_t num_keys : {size_t{1}, size_t{13}, size_t{37}}) {
+    std::vector<cuckoo::KeyT> keys;
+    for (size_t i = 0; i < num_keys; ++i) {
+      keys.push_back(i * 7 % records.size());
+    }
+    std::vector<size_t> seen;
+    table.find_batched_deref(
+        keys.data(), keys.size(), [&](size_t i, TableT::iterator it) {
+          seen.push_back(i);
+          if (keys[i] % 2) {
+            CHECK(it.is_null());
+          } else {
+            CHECK(reinterpret_cast<record*>(it.value())->key == keys[i]);
+          }
+        });
+    CHECK(seen.size() == num_keys);
+    for (size_t i = 0; i < num_keys; ++i) {
+      CHECK(seen[i] == i);
+    }
+  }
+}
+
+void test_probe_many() {
+  TableT table(256);
+  SetT set(256);
+  for (cuckoo::KeyT k = 0; k < 100; ++k) {
+    table.insert(k, k + 1);
+    if (k % 3 == 0) {
+      set.insert(k);
+    }
+  }
+
+  // longer than one batch_state, and of different lengths per table
+  std::vector<cuckoo::KeyT> keys;
+  for (cuckoo::KeyT k = 0; k < 3 * cuckoo::MAX_LOOKUP_BATCH_SZ + 5; ++k) {
+    keys.push_back(k * 7);
+  }
+  size_t num_set_keys = cuckoo::MAX_LOOKUP_BATCH_SZ + 3;
+  std::vector<TableT::iterator> table_results(keys.size());
+  std::vector<SetT::iterator> set_results(keys.size());
+  cuckoo::probe_many(
+      cuckoo::probe{table, keys.data(), keys.size(), table_results.data()},
+      cuckoo::probe{set, keys.data(), num_set_keys, set_results.data()});
+  for (size_t i = 0; i < keys.size(); ++i) {
+    TableT::iterator expected = table.find(keys[i]);
+    CHECK(expected.is_null() == (keys[i] >= 100));
+    CHECK(table_results[i].bucket_ == expected.bucket_ &&
+          table_results[i].slot_idx_ == expected.slot_idx_);
+    if (i < num_set_keys) {
+      CHECK(set_results[i].slot_ == set.find(keys[i]).slot_);
+    } else {
+      CHECK(set_results[i].is_null());
+    }
+  }
+}
+
+void test_displacement() {
+  // fill close to capacity so that most inserts displace
+  constexpr size_t CAPACITY = 4096;
+  constexpr cuckoo::KeyT NUM_KEYS = CAPACITY * 9 / 10;
+  TableT a(CAPACITY);
+  TableT b(CAPACITY);
+  TableT other(CAPACITY);
+  for (cuckoo::KeyT k = 0; k < NUM_KEYS; ++k) {
+    a.insert(k, k);
+  }
+  // inserting into another table in between must not change where b puts
+  // its entries
+  for (cuckoo::KeyT k = 0; k < NUM_KEYS; ++k) {
+    b.insert(k, k);
+    other.insert(k * 31 + 7, k);
+  }
+
+  CHECK(a.size() == NUM_KEYS);
+  for (cuckoo::KeyT k = 0; k < NUM_KEYS; ++k) {
+    CHECK(a.find(k).value() == k);
+  }
+  CHECK(entries(a) == entries(b));
+}
+
+void test_bucket_pair_search() {
+  using cuckoo::Bucket;
+  Bucket b1 = empty_bucket();
+  Bucket b2 = empty_bucket();
+  b1.update(2, 10, 100);
+  b2.update(1, 20, 200);
+  b2.update(3, 10, 300);
+
+  Bucket::iterator it = Bucket::find_pair_simd(b1, b2, 10);
+  CHECK(it.bucket_ == &b1 && it.slot_idx_ == 2);
+  it = Bucket::find_pair_simd(b1, b2, 20);
+  CHECK(it.bucket_ == &b2 && it.slot_idx_ == 1 && it.value() == 200);
+  CHECK(Bucket::find_pair_simd(b1, b2, 30).is_null());
+  it = Bucket::find_pair_simd(b2, b2, 20);
+  CHECK(it.bucket_ == &b2 && it.slot_idx_ == 1);
+  CHECK(Bucket::find_pair_simd(b1, b1, 20).is_null());
+}
+
+void test_duplicate_inserts() {
+  using cuckoo::Bucket;
+  Bucket b1 = empty_bucket();
+  Bucket b2 = empty_bucket();
+
+  // a duplicate behind a free slot of the same bucket
+  b1.update(2, 7, 70);
+  CHECK_THROWS(Bucket::insert_pair(b1, b2, 7, 1), std::runtime_error);
+  CHECK(b1.key_slots[0] == cuckoo::NULL_KEY && b1.value_slots[2] == 70);
+
+  // a duplicate in the second bucket while the first has room
+  b2.update(3, 8, 80);
+  CHECK_THROWS(Bucket::insert_pair(b1, b2, 8, 1), std::runtime_error);
+  CHECK(b1.key_slots[0] == cuckoo::NULL_KEY);
+
+  // fills the first bucket, then the second, then reports both full
+  CHECK(Bucket::insert_pair(b1, b2, 9, 90) && b1.key_slots[0] == 9);
+  CHECK(Bucket::insert_pair(b1, b2, 11, 0) && b1.key_slots[1] == 11);
+  CHECK(Bucket::insert_pair(b1, b2, 12, 0) && b1.key_slots[3] == 12);
+  for (cuckoo::KeyT k = 13; k < 16; ++k) {
+    CHECK(Bucket::insert_pair(b1, b2, k, 0));
+  }
+  CHECK(!Bucket::insert_pair(b1, b2, 16, 0));
+
+  TableT table(1024);
+  for (cuckoo::KeyT k = 0; k < 900; ++k) {
+    table.insert(k, k);
+  }
+  for (cuckoo::KeyT k = 0; k < 900; k += 50) {
+    CHECK_THROWS(table.insert(k, 1), std::runtime_error);
+    CHECK(table.find(k).value() == k);
+  }
+  CHECK(table.size() == 900);
+
+  SetT set(1024);
+  for (cuckoo::KeyT k = 0; k < 900; ++k) {
+    set.insert(k);
+  }
+  for (cuckoo::KeyT k = 0; k < 900; k += 50) {
+    CHECK_THROWS(set.insert(k), std::runtime_error);
+  }
+  CHECK(set.size() == 900);
+}
+
+std::vector<cuckoo::KvT> sorted_entries(TableT& table) {
+  std::vector<cuckoo::KvT> result = entries(table);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+void test_move_and_clone() {
+  constexpr cuckoo::KeyT NUM_KEYS = 3000;
+  TableT table(4096);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    table.insert(k, k * k);
+  }
+  const std::vector<cuckoo::KvT> expected = entries(table);
+
+  // a moved-from table is empty, and takes as many keys as before
+  TableT moved(std::move(table));
+  CHECK(entries(moved) == expected);
+  CHECK(table.size() == 0 && entries(table).empty());
+  CHECK(table.find(1).is_null());
+  CHECK(table.memory_usage().num_buckets == 0);
+  table.clear();
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    table.insert(k, k);
+  }
+  CHECK(table.size() == NUM_KEYS && table.load_factor() == moved.load_factor());
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    CHECK(table.find(k).value() == k);
+  }
+
+  // move assignment replaces the contents, swap exchanges them
+  TableT other(64);
+  other.insert(NUM_KEYS + 1, 0);
+  other = std::move(moved);
+  CHECK(entries(other) == expected);
+  other.swap(table);
+  CHECK(entries(table) == expected);
+  CHECK(other.size() == NUM_KEYS && other.find(2).value() == 2);
+
+  // a clone holds the same entries and does not share them
+  TableT copy = table.clone();
+  CHECK(entries(copy) == expected);
+  copy.erase(copy.find(1));
+  copy.insert(NUM_KEYS + 1, 0);
+  table.find(2).value() = 0;
+  CHECK(table.find(1).value() == 1 && table.find(NUM_KEYS + 1).is_null());
+  CHECK(copy.find(2).value() == 4);
+
+  // the clone of a moved-from table is another empty, usable table
+  TableT drained(std::move(copy));
+  TableT empty_copy = copy.clone();
+  CHECK(empty_copy.size() == 0 && empty_copy.find(2).is_null());
+  empty_copy.insert(2, 2);
+  CHECK(empty_copy.find(2).value() == 2 && copy.find(2).is_null());
+
+  // clear empties the table in place, and it takes the same keys again
+  table.clear();
+  CHECK(table.size() == 0 && entries(table).empty());
+  CHECK(table.find(1).is_null());
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    table.insert(k, k * k);
+  }
+  std::vector<cuckoo::KvT> sorted = expected;
+  std::sort(sorted.begin(), sorted.end());
+  CHECK(sorted_entries(table) == sorted);
+
+  SetT set(1024);
+  for (cuckoo::KeyT k = 1; k <= 700; ++k) {
+    set.insert(k);
+  }
+  SetT moved_set(std::move(set));
+  CHECK(set.size() == 0 && set.find(1).is_null());
+  CHECK(set.memory_usage().num_buckets == 0);
+  for (cuckoo::KeyT k = 1; k <= 700; ++k) {
+    set.insert(k);
+  }
+  CHECK(set.size() == 700 && !set.find(700).is_null());
+
+  SetT set_copy = moved_set.clone();
+  set_copy.erase(set_copy.find(1));
+  CHECK(!moved_set.find(1).is_null() && set_copy.size() == 699);
+  moved_set.clear();
+  CHECK(moved_set.size() == 0 && moved_set.find(2).is_null());
+  CHECK(!set_copy.find(2).is_null());
+}
+
+// Arrays of more than PARALLEL_MIN_BUCKETS are reset and copied by several
+// threads, each taking a range; every range has to be covered.
+void test_parallel_bucket_init() {
+  constexpr size_t CAPACITY = size_t{1} << 20;
+  constexpr cuckoo::KeyT NUM_KEYS = 100000;
+  TableT table(CAPACITY);
+  CHECK(entries(table).empty());
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    table.insert(k, k);
+  }
+
+  TableT copy = table.clone();
+  CHECK(entries(copy) == entries(table));
+  table.clear();
+  CHECK(entries(table).empty());
+  CHECK(copy.size() == NUM_KEYS && copy.find(NUM_KEYS).value() == NUM_KEYS);
+
+  SetT set(2 * CAPACITY);
+  size_t num_keys = 0;
+  set.for_each([&](cuckoo_set::KeyT) { num_keys++; });
+  CHECK(num_keys == 0);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    set.insert(k);
+  }
+  SetT set_copy = set.clone();
+  set.clear();
+  set_copy.for_each([&](cuckoo_set::KeyT) { num_keys++; });
+  CHECK(num_keys == NUM_KEYS && set.find(1).is_null());
+}
+
+void test_shrink_to_fit() {
+  constexpr cuckoo::KeyT NUM_KEYS = 50000;
+  TableT table(NUM_KEYS * 2);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    table.insert(k, k);
+  }
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    if (k % 16 != 0) {
+      table.erase(table.find(k));
+    }
+  }
+  for (double max_load : {0.0, -1.0, 1.5, std::nan("")}) {
+    CHECK_THROWS(table.shrink_to_fit(max_load), std::invalid_argument);
+  }
+  const double load_factor = table.load_factor();
+  table.shrink_to_fit();
+  CHECK(table.load_factor() > load_factor);
+  CHECK(table.size() == NUM_KEYS / 16 && table.load_factor() <= 0.5);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    auto it = table.find(k);
+    CHECK(k % 16 == 0 ? !it.is_null() && it.value() == k : it.is_null());
+  }
+
+  SetT set(NUM_KEYS * 2);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    set.insert(k);
+  }
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    if (k % 16 != 0) {
+      set.erase(set.find(k));
+    }
+  }
+  CHECK_THROWS(set.shrink_to_fit(0.0), std::invalid_argument);
+  CHECK_THROWS(set.shrink_to_fit(std::nan("")), std::invalid_argument);
+  const double set_load_factor = set.load_factor();
+  set.shrink_to_fit(0.9);
+  CHECK(set.load_factor() > set_load_factor);
+  for (cuckoo::KeyT k = 1; k <= NUM_KEYS; ++k) {
+    CHECK(set.find(k).is_null() == (k % 16 != 0));
+  }
+}
+
+void test_pool_allocator() {
+  using cuckoo::Bucket;
+  using PoolSetT =
+      cuckoo_set::cuckoo_set<CRCHash<uint64_t>,
+                             cuckoo::pool_allocator<cuckoo_set::Bucket>>;
+  const size_t base_page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  PoolSetT small_set(64);
+  CHECK(small_set.memory_usage().page_size == base_page_size);
+  // 2 MiB of buckets
+  PoolSetT large_set(size_t{1} << 18);
+  CHECK(large_set.memory_usage().page_size ==
+        cuckoo::bucket_pool::huge_page_size);
+
+  // a freed array comes back from this thread's cache for the same size class
+  cuckoo::pool_allocator<Bucket> allocator;
+  Bucket* p = allocator.allocate(100);
+  allocator.deallocate(p, 100);
+  Bucket* q = allocator.allocate(128);
+  CHECK(q == p);
+  allocator.deallocate(q, 128);
+
+  // arrays freed by another thread, past its cache and in it when it exits,
+  // reach this thread through the shared free lists
+  constexpr size_t NUM_ARRAYS = 6;
+  constexpr size_t NUM_BUCKETS = 3000;
+  std::vector<Bucket*> freed;
+  std::thread([&] {
+    for (size_t i = 0; i < NUM_ARRAYS; ++i) {
+      freed.push_back(allocator.allocate(NUM_BUCKETS));
+    }
+    for (Bucket* array : freed) {
+      allocator.deallocate(array, NUM_BUCKETS);
+    }
+  }).join();
+  std::vector<Bucket*> reused;
+  for (size_t i = 0; i < NUM_ARRAYS; ++i) {
+    reused.push_back(allocator.allocate(NUM_BUCKETS));
+  }
+  std::sort(freed.begin(), freed.end());
+  std::sort(reused.begin(), reused.end());
+  CHECK(reused == freed);
+  for (Bucket* array : reused) {
+    allocator.deallocate(array, NUM_BUCKETS);
+  }
+}
+
+void test_recommend_capacity() {
+  static_assert(TableT::recommend_capacity(1000, 0.5) == 2048);
+  static_assert(SetT::recommend_capacity(1024, 1.0) == 1024);
+  // the last is in range, but asks for more slots than a size_t can count
+  for (double load : {0.0, -0.5, 1.5, std::nan(""), 1e-300}) {
+    CHECK_THROWS(TableT::recommend_capacity(1000, load),
+                 std::invalid_argument);
+    CHECK_THROWS(SetT::recommend_capacity(1000, load), std::invalid_argument);
+  }
+  CHECK(TableT::recommend_capacity(0, 0.9) == cuckoo::SLOTS_PER_BUCKET);
+}
+
+void test_concurrent_reserved_key() {
+  using ConcurrentT = cuckoo::concurrent_cuckoo_table<CRCHash<uint64_t>>;
+  ConcurrentT table(64);
+  table.insert(1, 10);
+  CHECK_THROWS(table.insert(cuckoo::NULL_KEY, 1), std::invalid_argument);
+  CHECK_THROWS(table.erase(cuckoo::NULL_KEY), std::invalid_argument);
+  // rejected before the valid op ahead of it is applied
+  using Type = ConcurrentT::write_op::Type;
+  ConcurrentT::write_op ops[] = {{Type::erase, 1},
+                                 {Type::insert, cuckoo::NULL_KEY, 1}};
+  CHECK_THROWS(table.write_batched(ops, 2), std::invalid_argument);
+  CHECK(!ops[0].applied && table.size() == 1);
+
+  CHECK(!table.find(cuckoo::NULL_KEY));
+  cuckoo::KeyT keys[] = {cuckoo::NULL_KEY, 1};
+  std::optional<cuckoo::ValueT> values[2];
+  table.find_batched(keys, 2, values);
+  CHECK(!values[0] && values[1] == 10);
+}
+
+// Keeps a nearly full table's pending buffer churning while readers look up
+// keys that stay put; they must find each of them every time, whether it sits
+// in a bucket, in the buffer, or is being moved between the two.
+void test_concurrent_pending() {
+  using ConcurrentT = cuckoo::concurrent_cuckoo_table<CRCHash<uint64_t>>;
+  constexpr cuckoo::KeyT NUM_STABLE = 56;
+  constexpr cuckoo::KeyT NUM_CHURN = 16;
+  ConcurrentT table(64);
+  for (cuckoo::KeyT k = 1; k <= NUM_STABLE; ++k) {
+    table.insert(k, k * 10);
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> num_misses{0};
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < 2; ++t) {
+    readers.emplace_back([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        for (cuckoo::KeyT k = 1; k <= NUM_STABLE; ++k) {
+          std::optional<cuckoo::ValueT> value = table.find(k);
+          num_misses += !value || *value != k * 10;
+        }
+      }
+    });
+  }
+  for (size_t round = 0; round < 200; ++round) {
+    for (cuckoo::KeyT k = 1; k <= NUM_CHURN; ++k) {
+      try {
+        table.insert(NUM_STABLE + k, round);
+      } catch (const std::runtime_error&) {
+        // no room could be made; the key stays absent
+      }
+    }
+    for (cuckoo::KeyT k = 1; k <= NUM_CHURN; ++k) {
+      table.erase(NUM_STABLE + k);
+    }
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  CHECK(num_misses == 0);
+  CHECK(table.size() == NUM_STABLE);
+}
+
+// An assign inserts an absent key and replaces a present one's value, in a
+// bucket, in the pending buffer, or after making room itself.
+void test_concurrent_assign() {
+  using ConcurrentT = cuckoo::concurrent_cuckoo_table<CRCHash<uint64_t>>;
+  using Type = ConcurrentT::write_op::Type;
+  ConcurrentT table(64);
+  std::vector<ConcurrentT::write_op> ops = {
+      {Type::assign, 1, 10}, {Type::assign, 1, 11}, {Type::insert, 1, 12},
+      {Type::erase, 2},      {Type::assign, 2, 20},
+  };
+  table.write_batched(ops.data(), ops.size());
+  CHECK(!ops[0].found && ops[1].found && ops[2].found);
+  CHECK(!ops[3].found && !ops[4].found);
+  CHECK(table.find(1) == 11 && table.find(2) == 20 && table.size() == 2);
+
+  for (bool background : {true, false}) {
+    ConcurrentT full(64, background);
+    ops.clear();
+    for (cuckoo::KeyT k = 1; k <= 56; ++k) {
+      ops.push_back({Type::assign, k, k});
+    }
+    for (cuckoo::KeyT k = 1; k <= 56; ++k) {
+      ops.push_back({Type::assign, k, k * 2});
+    }
+    full.write_batched(ops.data(), ops.size());
+    full.wait_for_relocations();
+    CHECK(full.size() == 56);
+    for (size_t i = 0; i < ops.size(); ++i) {
+      CHECK(ops[i].applied && ops[i].found == (i >= 56));
+    }
+    for (cuckoo::KeyT k = 1; k <= 56; ++k) {
+      CHECK(full.find(k) == k * 2);
+    }
+  }
+}
+
+void test_write_buffer() {
+  using ConcurrentT = cuckoo::concurrent_cuckoo_table<CRCHash<uint64_t>>;
+  // inserts make room themselves, and throw once they cannot
+  ConcurrentT table(16, false);
+  cuckoo::write_buffer<ConcurrentT, 8> buffer(table);
+
+  // reads replay the buffered writes as the flush will apply them
+  table.insert(1, 10);
+  buffer.insert(1, 11);
+  CHECK(buffer.find(1) == 10);
+  buffer.erase(1);
+  buffer.insert(1, 12);
+  CHECK(buffer.find(1) == 12);
+  buffer.insert(2, 20);
+  buffer.erase(2);
+  CHECK(!buffer.find(2));
+  buffer.flush();
+  CHECK(table.find(1) == 12 && !table.find(2) && table.size() == 1);
+  table.erase(1);
+  CHECK_THROWS(buffer.insert(cuckoo::NULL_KEY, 1), std::invalid_argument);
+  CHECK(buffer.size() == 0);
+
+  // overfill the table through the buffer
+  std::vector<cuckoo::KeyT> pushed;
+  bool thrown = false;
+  for (cuckoo::KeyT k = 1; k <= 64 && !thrown; ++k) {
+    try {
+      buffer.insert(k, k);
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    pushed.push_back(k);
+  }
+  CHECK(thrown);
+  // the writes the failed flush did not apply are still buffered
+  CHECK(buffer.size() > 0);
+  CHECK(table.size() + buffer.size() == pushed.size());
+  for (cuckoo::KeyT k : pushed) {
+    CHECK(buffer.find(k) == k);
+  }
+
+  // and the next flush applies them once there is room
+  std::vector<cuckoo::KeyT> buffered;
+  for (cuckoo::KeyT k : pushed) {
+    if (table.find(k)) {
+      table.erase(k);
+    } else {
+      buffered.push_back(k);
+    }
+  }
+  buffer.flush();
+  CHECK(buffer.size() == 0 && table.size() == buffered.size());
+  for (cuckoo::KeyT k : buffered) {
+    CHECK(table.find(k) == k);
+  }
+}
+
+// A stand-in for concurrent_cuckoo_table whose inserts of BAD_KEY throw
+// std::bad_alloc, to check how flat_combining_table passes errors on.
+struct throwing_table {
+  static constexpr cuckoo::KeyT BAD_KEY = 13;
+
+  struct write_op {
+    enum class Type : uint8_t { insert, erase };
+
+    Type type;
+    cuckoo::KeyT key;
+    cuckoo::ValueT value{cuckoo::NULL_VALUE};
+    bool found{false};
+    bool applied{false};
+  };
+
+  void write_batched(write_op* ops, size_t num_ops) {
+    for (size_t i = 0; i < num_ops; ++i) {
+      write_op& op = ops[i];
+      if (op.type == write_op::Type::insert && op.key == BAD_KEY) {
+        throw std::bad_alloc();
+      }
+      auto it = std::find_if(entries.begin(), entries.end(),
+                             [&](const auto& e) { return e.first == op.key; });
+      op.found = it != entries.end();
+      if (op.type == write_op::Type::erase && op.found) {
+        entries.erase(it);
+      } else if (op.type == write_op::Type::insert && !op.found) {
+        entries.emplace_back(op.key, op.value);
+      }
+      op.applied = true;
+    }
+  }
+
+  std::optional<cuckoo::ValueT> find(cuckoo::KeyT key) {
+    for (const auto& e : entries) {
+      if (e.first == key) {
+        return e.second;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::vector<cuckoo::KvT> entries;
+};
+
+void test_flat_combining_errors() {
+  throwing_table table;
+  cuckoo::flat_combining_table<throwing_table, 4> combining(table);
+  auto handle = combining.register_thread();
+  handle.insert(1, 10);
+  // the combiner's exception reaches the thread whose op failed, and the
+  // combiner role is released for the next write
+  CHECK_THROWS(handle.insert(throwing_table::BAD_KEY, 0), std::bad_alloc);
+  handle.insert(2, 20);
+  CHECK_THROWS(handle.insert(2, 21), std::runtime_error);
+  CHECK(handle.erase(1) && !handle.erase(1));
+  CHECK(handle.find(2) == 20 && table.entries.size() == 1);
+}
+
+void test_batched_key_layouts() {
+  struct record {
+    uint32_t id;
+    cuckoo::KeyT key;  // unaligned within the packed array below
+  } __attribute__((packed));
+
+  TableT table(256);
+  SetT set(256);
+  for (cuckoo::KeyT k = 0; k < 200; k += 3) {
+    table.insert(k, k);
+    set.insert(k);
+  }
+
+  // more than one batch, and not a whole number of them
+  constexpr size_t NUM_KEYS = 3 * cuckoo::MAX_LOOKUP_BATCH_SZ + 5;
+  std::array<cuckoo::KeyT, NUM_KEYS> keys;
+  std::array<record, NUM_KEYS> records;
+  std::array<cuckoo::KeyT, 4 * NUM_KEYS> pool;
+  std::array<size_t, NUM_KEYS> idxs;
+  pool.fill(cuckoo::NULL_KEY);
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    keys[i] = i * 5;
+    records[i] = {static_cast<uint32_t>(i), keys[i]};
+    idxs[i] = (i * 11) % pool.size();
+    pool[idxs[i]] = keys[i];
+  }
+
+  std::array<TableT::iterator, NUM_KEYS> expected, strided, gathered;
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    expected[i] = table.find(keys[i]);
+  }
+  table.find_batched_strided(records.data(), sizeof(record),
+                             offsetof(record, key), NUM_KEYS, strided.data());
+  table.find_batched_gather(pool.data(), idxs.data(), NUM_KEYS,
+                            gathered.data());
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    CHECK(expected[i].is_null() == (keys[i] % 3 != 0));
+    CHECK(strided[i].bucket_ == expected[i].bucket_ &&
+          strided[i].slot_idx_ == expected[i].slot_idx_);
+    CHECK(gathered[i].bucket_ == expected[i].bucket_ &&
+          gathered[i].slot_idx_ == expected[i].slot_idx_);
+  }
+
+  std::array<SetT::iterator, NUM_KEYS> set_expected, set_strided, set_gathered;
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    set_expected[i] = set.find(keys[i]);
+  }
+  set.find_batched_strided(records.data(), sizeof(record),
+                           offsetof(record, key), NUM_KEYS,
+                           set_strided.data());
+  set.find_batched_gather(pool.data(), idxs.data(), NUM_KEYS,
+                          set_gathered.data());
+  for (size_t i = 0; i < NUM_KEYS; ++i) {
+    CHECK(set_expected[i].is_null() == (keys[i] % 3 != 0));
+    CHECK(set_strided[i].slot_ == set_expected[i].slot_);
+    CHECK(set_gathered[i].slot_ == set_expected[i].slot_);
+  }
+}
+
+void test_front_cache() {
+  TableT table(1024);
+  for (cuckoo::KeyT k = 0; k < 500; ++k) {
+    table.insert(k, k * 2);
+  }
+  cuckoo::front_cache<TableT, 16, 2> cache(table);
+
+  // longer than a lookup batch, with repeats so that some keys hit the cache
+  std::vector<cuckoo::KeyT> keys;
+  for (cuckoo::KeyT k = 0; k < 5 * cuckoo::MAX_LOOKUP_BATCH_SZ + 3; ++k) {
+    keys.push_back(k % 13 * 41);
+  }
+  for (int round = 0; round < 2; ++round) {
+    std::vector<TableT::iterator> results(keys.size());
+    cache.find_batched(keys.data(), keys.size(), results.data());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] < 500) {
+        CHECK(!results[i].is_null() && results[i].value() == keys[i] * 2);
+      } else {
+        CHECK(results[i].is_null());
+      }
+    }
+  }
+
+  // writes move the epoch and drop cached iterators
+  table.erase(table.find(41));
+  CHECK(cache.find(41).is_null());
+  table.insert(41, 1);
+  CHECK(cache.find(41).value() == 1);
+}
+
+// Bucket address and slot index of a found key.
+std::pair<uintptr_t, size_t> locate(TableT::iterator it) {
+  return {reinterpret_cast<uintptr_t>(it.bucket_), it.slot_idx_};
+}
+
+std::pair<uintptr_t, size_t> locate(SetT::iterator it) {
+  auto addr = reinterpret_cast<uintptr_t>(it.slot_);
+  return {addr / sizeof(cuckoo_set::Bucket) * sizeof(cuckoo_set::Bucket),
+          addr % sizeof(cuckoo_set::Bucket) / sizeof(cuckoo::KeyT)};
+}
+
+// Looks up a few keys that are not in slot 0 of their primary bucket, each
+// many times, and checks that rebalance() moves all of them there. The table
+// holds keys [0, num_keys) in `num_buckets` buckets.
+template <class Table, class Bucket>
+void check_rebalance(Table& table, cuckoo::KeyT num_keys,
+                     size_t num_buckets) {
+  CHECK(table.rebalance() == 0);  // nothing sampled yet
+
+  size_t bucket_mask = num_buckets - 1;
+  auto primary_id = [&](cuckoo::KeyT key) {
+    return CRCHash<uint64_t>{}(key) & bucket_mask;
+  };
+  auto other_id = [&](cuckoo::KeyT key) {
+    size_t hash = CRCHash<uint64_t>{}(key);
+    return CRCHash<uint64_t>{}(hash ^ key) & bucket_mask;
+  };
+
+  // the bucket array's base address is the one both candidate buckets of
+  // every key agree on
+  std::vector<uintptr_t> bases;
+  for (cuckoo::KeyT key = 0; key < 2; ++key) {
+    uintptr_t addr = locate(table.find(key)).first;
+    bases.push_back(addr - primary_id(key) * sizeof(Bucket));
+    bases.push_back(addr - other_id(key) * sizeof(Bucket));
+  }
+  uintptr_t base = bases[0] == bases[2] || bases[0] == bases[3] ? bases[0]
+                                                                 : bases[1];
+  auto in_primary_slot0 = [&](cuckoo::KeyT key) {
+    auto [addr, slot] = locate(table.find(key));
+    return addr == base + primary_id(key) * sizeof(Bucket) && slot == 0;
+  };
+
+  std::vector<cuckoo::KeyT> hot;
+  std::vector<size_t> hot_buckets;
+  for (cuckoo::KeyT key = 0; key < num_keys && hot.size() < 8; ++key) {
+    size_t id = primary_id(key);
+    if (!in_primary_slot0(key) &&
+        std::find(hot_buckets.begin(), hot_buckets.end(), id) ==
+            hot_buckets.end()) {
+      hot.push_back(key);
+      hot_buckets.push_back(id);
+    }
+  }
+  CHECK(hot.size() == 8);
+
+  // sample every lookup, through both find() and find_batched()
+  table.set_access_sampling(1);
+  for (int round = 0; round < 20; ++round) {
+    for (cuckoo::KeyT key : hot) {
+      table.find(key);
+    }
+    std::vector<typename Table::iterator> results(hot.size());
+    table.find_batched(hot.data(), hot.size(), results.data());
+  }
+
+  CHECK(table.rebalance() == hot.size());
+  // the samples were consumed
+  CHECK(table.rebalance() == 0);
+  table.set_access_sampling(0);
+
+  for (cuckoo::KeyT key : hot) {
+    CHECK(in_primary_slot0(key));
+  }
+  for (cuckoo::KeyT key = 0; key < num_keys; ++key) {
+    CHECK(!table.find(key).is_null());
+  }
+  CHECK(table.size() == num_keys);
+}
+
+void test_rebalance() {
+  // the sample ring is only allocated once sampling is enabled
+  static_assert(sizeof(TableT) < 256);
+  static_assert(sizeof(SetT) < 256);
+
+  constexpr size_t CAPACITY = 4096;
+  constexpr cuckoo::KeyT NUM_KEYS = 2048;
+  TableT table(CAPACITY);
+  SetT set(CAPACITY);
+  for (cuckoo::KeyT k = 0; k < NUM_KEYS; ++k) {
+    table.insert(k, k);
+    set.insert(k);
+  }
+  check_rebalance<TableT, cuckoo::Bucket>(table, NUM_KEYS,
+                                          CAPACITY / cuckoo::SLOTS_PER_BUCKET);
+  check_rebalance<SetT, cuckoo_set::Bucket>(
+      set, NUM_KEYS, CAPACITY / cuckoo_set::SLOTS_PER_BUCKET);
+  for (cuckoo::KeyT k = 0; k < NUM_KEYS; ++k) {
+    CHECK(table.find(k).value() == k);
+  }
+
+  // disabling sampling drops the samples
+  table.set_access_sampling(1);
+  table.find(1);
+  table.set_access_sampling(0);
+  CHECK(table.rebalance() == 0);
+}
+
+// Checks every lookup entry point of an adaptive_table holding `value(k)` for
+// each key in `present`, and no key in `absent`.
+template <class Table, class Value>
+void check_adaptive_lookups(Table& table,
+                            const std::vector<cuckoo::KeyT>& present,
+                            const std::vector<cuckoo::KeyT>& absent,
+                            Value value) {
+  std::vector<cuckoo::KeyT> keys;
+  for (size_t i = 0; i < present.size(); ++i) {
+    keys.push_back(present[i]);
+    if (i < absent.size()) {
+      keys.push_back(absent[i]);
+    }
+  }
+  auto check = [&](size_t i, typename Table::iterator it) {
+    bool hit = std::find(present.begin(), present.end(), keys[i]) !=
+               present.end();
+    CHECK(it.is_null() != hit);
+    CHECK(!hit || (it.key() == keys[i] && it.value() == value(keys[i])));
+  };
+
+  std::vector<typename Table::iterator> results(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    check(i, table.find(keys[i]));
+  }
+  table.find_batched(keys.data(), keys.size(), results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    check(i, results[i]);
+  }
+
+  std::vector<std::pair<uint32_t, cuckoo::KeyT>> records;
+  std::vector<size_t> idxs;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    records.emplace_back(0, keys[i]);
+    idxs.push_back(keys.size() - 1 - i);
+  }
+  std::vector<cuckoo::KeyT> reversed(keys.rbegin(), keys.rend());
+  table.find_batched_strided(records.data(), sizeof(records[0]),
+                             offsetof(decltype(records)::value_type, second),
+                             keys.size(), results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    check(i, results[i]);
+  }
+  table.find_batched_gather(reversed.data(), idxs.data(), keys.size(),
+                            results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    check(i, results[i]);
+  }
+
+  size_t num_calls = 0;
+  table.find_batched_deref(keys.data(), keys.size(),
+                           [&](size_t i, typename Table::iterator it) {
+                             CHECK(i == num_calls++);
+                             check(i, it);
+                           });
+  CHECK(num_calls == keys.size());
+}
+
+void test_adaptive() {
+  using AdaptiveTableT = cuckoo::adaptive_table<CRCHash<uint64_t>>;
+  auto value = [](cuckoo::KeyT key) { return key * 3; };
+  constexpr cuckoo::KeyT BASE = 1000000;
+  constexpr size_t NUM_KEYS = 2048;
+
+  AdaptiveTableT table(1 << 14);
+  std::vector<cuckoo::KeyT> present, absent;
+  for (cuckoo::KeyT k = BASE; k < BASE + NUM_KEYS; ++k) {
+    // below the minimum size both representations are small
+    CHECK(table.is_dense() == (table.size() >= 1024));
+    table.insert(k, value(k));
+    present.push_back(k);
+  }
+  for (cuckoo::KeyT k = 0; k < 40; ++k) {
+    absent.push_back(k % 2 ? BASE - 1 - k : BASE + NUM_KEYS + k);
+  }
+  CHECK(table.is_dense() && table.size() == NUM_KEYS);
+  CHECK_THROWS(table.insert(BASE, 1), std::runtime_error);
+  check_adaptive_lookups(table, present, absent, value);
+
+  // a key far outside the range makes it sparse again
+  constexpr cuckoo::KeyT FAR_KEY = cuckoo::KeyT{1} << 40;
+  table.insert(FAR_KEY, value(FAR_KEY));
+  present.push_back(FAR_KEY);
+  CHECK(!table.is_dense() && table.size() == NUM_KEYS + 1);
+  check_adaptive_lookups(table, present, absent, value);
+
+  // the hashed key range is conservative, so erasing it again does not make
+  // the next insert switch back
+  table.erase(table.find(FAR_KEY));
+  present.pop_back();
+  table.insert(BASE + NUM_KEYS, value(BASE + NUM_KEYS));
+  present.push_back(BASE + NUM_KEYS);
+  absent.erase(std::find(absent.begin(), absent.end(), BASE + NUM_KEYS));
+  CHECK(!table.is_dense() && table.size() == NUM_KEYS + 1);
+  check_adaptive_lookups(table, present, absent, value);
+
+  // hysteresis: thinning out a dense table keeps it dense well below the
+  // density at which a hashed one goes dense
+  AdaptiveTableT shrinking(1 << 14);
+  for (cuckoo::KeyT key = 0; key < NUM_KEYS; ++key) {
+    shrinking.insert(key, value(key));
+  }
+  CHECK(shrinking.is_dense());
+  std::vector<cuckoo::KeyT> kept;
+  size_t switched_at = 0;
+  for (cuckoo::KeyT key = 0; key < NUM_KEYS; ++key) {
+    if (key % 8 == 0 || switched_at) {
+      kept.push_back(key);
+      continue;
+    }
+    shrinking.erase(shrinking.find(key));
+    if (!shrinking.is_dense()) {
+      switched_at = shrinking.size();
+    }
+  }
+  // keys 0 and NUM_KEYS - 8 remain, so the range stays NUM_KEYS wide
+  CHECK(switched_at > 0 && switched_at * 2 < NUM_KEYS);
+  check_adaptive_lookups(shrinking, kept, {1, 2, 3, NUM_KEYS + 1}, value);
+  // and the hashed table does not flip back on the next insert
+  shrinking.insert(1, value(1));
+  CHECK(!shrinking.is_dense());
+
+  using AdaptiveSetT = cuckoo::adaptive_set<
+      CRCHash<uint64_t>, aligned_allocator<cuckoo_set::Bucket>>;
+  AdaptiveSetT set(1 << 14);
+  for (cuckoo::KeyT key = 0; key < NUM_KEYS; ++key) {
+    set.insert(key * 4);
+  }
+  CHECK(set.is_dense());
+  std::vector<cuckoo::KeyT> keys;
+  for (cuckoo::KeyT key = 0; key < 4 * NUM_KEYS + 5; key += 3) {
+    keys.push_back(key);
+  }
+  std::vector<AdaptiveSetT::iterator> results(keys.size());
+  set.find_batched(keys.data(), keys.size(), results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    bool hit = keys[i] % 4 == 0 && keys[i] < 4 * NUM_KEYS;
+    CHECK(results[i].is_null() != hit);
+    CHECK(set.find(keys[i]).is_null() == results[i].is_null());
+  }
+  set.insert(FAR_KEY);
+  CHECK(!set.is_dense());
+  set.find_batched(keys.data(), keys.size(), results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    bool hit = keys[i] % 4 == 0 && keys[i] < 4 * NUM_KEYS;
+    CHECK(results[i].is_null() != hit);
+  }
+}
+
+// Hashes as CRCHash until `degenerate` is set, then sends every key to bucket
+// 0, so that no more than a bucket pair's worth of keys can be hashed.
+struct switchable_hash {
+  static inline bool degenerate = false;
+
+  size_t operator()(uint64_t key) const {
+    return degenerate ? 0 : CRCHash<uint64_t>()(key);
+  }
+};
+
+void test_adaptive_limits() {
+  // dense mode stops short of the capacity, where the hashed table would
+  // fail, so a nearly full dense table can still switch back
+  constexpr size_t CAPACITY = 4096;
+  cuckoo::adaptive_table<CRCHash<uint64_t>> table(CAPACITY);
+  cuckoo::KeyT next = 0;
+  try {
+    for (; next < CAPACITY; ++next) {
+      table.insert(next, next);
+    }
+  } catch (const std::runtime_error&) {
+  }
+  CHECK(table.is_dense() && next > CAPACITY * 3 / 4 && next < CAPACITY);
+  constexpr cuckoo::KeyT FAR_KEY = cuckoo::KeyT{1} << 40;
+  table.insert(FAR_KEY, 1);
+  CHECK(!table.is_dense() && table.size() == next + 1);
+  for (cuckoo::KeyT k = 0; k < next; ++k) {
+    CHECK(!table.find(k).is_null() && table.find(k).value() == k);
+  }
+
+  // a switch back that cannot fit every key leaves the bitmap as it was
+  cuckoo::adaptive_set<switchable_hash,
+                       aligned_allocator<cuckoo_set::Bucket>>
+      set(1 << 14);
+  for (cuckoo::KeyT k = 0; k < 2048; ++k) {
+    set.insert(k);
+  }
+  CHECK(set.is_dense());
+  switchable_hash::degenerate = true;
+  CHECK_THROWS(set.insert(FAR_KEY), std::runtime_error);
+  // erasing down to a sparse range tries the switch too, and stays dense
+  for (cuckoo::KeyT k = 0; k < 2048; ++k) {
+    if (k % 128) {
+      set.erase(set.find(k));
+    }
+  }
+  switchable_hash::degenerate = false;
+  CHECK(set.is_dense() && set.size() == 16);
+  for (cuckoo::KeyT k = 0; k < 2048; ++k) {
+    CHECK(set.find(k).is_null() == (k % 128 != 0));
+  }
+  CHECK(set.find(FAR_KEY).is_null());
+}
+
+// constant-initialized, no code runs to empty it
+constinit cuckoo::fixed_cuckoo_table<1024, CRCHash<uint64_t>> static_table;
+
+template <class Table>
+void check_fixed_table(Table& table) {
+  CHECK(table.size() == 0);
+  for (cuckoo::KeyT k = 0; k < 200; ++k) {
+    CHECK(table.find(k).is_null());
+    table.insert(k, k + 1);
+  }
+  std::vector<cuckoo::KeyT> keys;
+  for (cuckoo::KeyT k = 192; k < 208; ++k) {
+    keys.push_back(k);
+  }
+  std::vector<cuckoo::Bucket::iterator> results(keys.size());
+  for (size_t base = 0; base < keys.size();
+       base += cuckoo::MAX_LOOKUP_BATCH_SZ) {
+    table.find_batched(keys.data() + base, cuckoo::MAX_LOOKUP_BATCH_SZ,
+                       results.data() + base);
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    CHECK(results[i].is_null() == (keys[i] >= 200));
+    CHECK(results[i].is_null() || results[i].value() == keys[i] + 1);
+  }
+  table.erase(table.find(5));
+  CHECK(table.find(5).is_null() && table.size() == 199);
+}
+
+void test_fixed_table() {
+  cuckoo::small_cuckoo_table<cuckoo::MAX_SMALL_CAPACITY, CRCHash<uint64_t>>
+      table;
+  check_fixed_table(table);
+  check_fixed_table(static_table);
+}
+
+flow_table::ipv4_5tuple make_flow(uint32_t i) {
+  return {i, ~i, static_cast<uint16_t>(i), 80, 6};
+}
+
+// Allocates buckets but fails to allocate entries, and counts live buckets.
+template <class T>
+struct failing_entry_allocator {
+  using value_type = T;
+
+  failing_entry_allocator() = default;
+  template <class U>
+  failing_entry_allocator(const failing_entry_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if constexpr (!std::is_same_v<T, flow_table::Bucket>) {
+      throw std::bad_alloc{};
+    }
+    live_buckets += n;
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    live_buckets -= n;
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  static inline size_t live_buckets = 0;
+};
+
+void test_flow_table() {
+  using FlowTableT = flow_table::flow_table<flow_table::ipv4_5tuple>;
+  constexpr size_t CAPACITY = 1024;
+  FlowTableT table(CAPACITY);
+
+  // high enough load that inserts displace
+  constexpr uint32_t NUM_FLOWS = CAPACITY * 9 / 10;
+  for (uint32_t i = 0; i < NUM_FLOWS; ++i) {
+    FlowTableT::iterator it = table.insert(make_flow(i), i, i % 100);
+    CHECK(!it.is_null() && it.value() == i && it.timestamp() == i % 100);
+  }
+  CHECK(table.size() == NUM_FLOWS);
+  CHECK_THROWS(table.insert(make_flow(3), 0, 0), std::runtime_error);
+  for (uint32_t i = 0; i < NUM_FLOWS; ++i) {
+    FlowTableT::iterator it = table.find(make_flow(i));
+    CHECK(!it.is_null() && it.value() == i && it.timestamp() == i % 100);
+  }
+  CHECK(table.find(make_flow(NUM_FLOWS)).is_null());
+
+  // eviction victims come from per-table state, so filling another table in
+  // between does not change where the same inserts put their flows
+  FlowTableT same(CAPACITY);
+  FlowTableT other(CAPACITY);
+  for (uint32_t i = 0; i < NUM_FLOWS; ++i) {
+    same.insert(make_flow(i), i, i % 100);
+    other.insert(make_flow(i * 31 + 7), i, 0);
+  }
+  auto layout = [](FlowTableT& t) {
+    std::vector<std::pair<ptrdiff_t, size_t>> slots;
+    const flow_table::Bucket* first = t.find(make_flow(0)).bucket_;
+    for (uint32_t i = 0; i < NUM_FLOWS; ++i) {
+      FlowTableT::iterator it = t.find(make_flow(i));
+      slots.emplace_back(it.bucket_ - first, it.slot_idx_);
+    }
+    return slots;
+  };
+  CHECK(layout(table) == layout(same));
+
+  // bursts longer than MAX_BURST_SZ, with keys embedded in larger records
+  struct packet {
+    uint8_t header[3];
+    flow_table::ipv4_5tuple flow;
+  };
+  std::vector<packet> packets(3 * flow_table::MAX_BURST_SZ + 5);
+  for (uint32_t i = 0; i < packets.size(); ++i) {
+    packets[i].flow = make_flow(i * 2);
+  }
+  std::vector<FlowTableT::iterator> results(packets.size());
+  table.lookup_burst(&packets[0].flow, sizeof(packet), packets.size(),
+                     results.data(), 1000);
+  size_t num_touched = 0;
+  for (uint32_t i = 0; i < packets.size(); ++i) {
+    if (i * 2 < NUM_FLOWS) {
+      num_touched++;
+      CHECK(!results[i].is_null() && results[i].value() == i * 2);
+      CHECK(results[i].timestamp() == 1000);
+    } else {
+      CHECK(results[i].is_null());
+    }
+  }
+
+  // flows looked up at 1000 stay, the rest were last seen before 100
+  size_t num_expired = 0;
+  for (size_t step = 0; step < CAPACITY; ++step) {
+    num_expired += table.age(1000, 500, 1);
+  }
+  CHECK(num_expired == NUM_FLOWS - num_touched);
+  CHECK(table.size() == num_touched);
+  for (uint32_t i = 0; i < NUM_FLOWS; ++i) {
+    bool touched = i % 2 == 0 && i / 2 < packets.size();
+    CHECK(table.find(make_flow(i)).is_null() != touched);
+  }
+  CHECK(table.age(1000, 500, CAPACITY) == 0);
+
+  // the bucket array is freed if the entry array cannot be allocated
+  using FailingTableT =
+      flow_table::flow_table<flow_table::ipv4_5tuple,
+                             flow_table::flow_hash<flow_table::ipv4_5tuple>,
+                             failing_entry_allocator<flow_table::Bucket>>;
+  CHECK_THROWS(FailingTableT{CAPACITY}, std::bad_alloc);
+  CHECK(failing_entry_allocator<flow_table::Bucket>::live_buckets == 0);
+}
+
+void test_resp_parsing() {
+  using resp::parse_result;
+  using resp::request;
+  std::vector<std::string_view> args;
+  std::vector<cuckoo::KeyT> keys;
+  size_t consumed = 0;
+
+  // a RESP array, followed by the start of the next request
+  std::string set = "*3\r\n$3\r\nSET\r\n$1\r\n5\r\n$2\r\n42\r\n";
+  std::string in = set + "PI";
+  CHECK(resp::parse_request(in, consumed, args) == parse_result::complete);
+  CHECK(consumed == set.size() && args.size() == 3);
+  CHECK(args[0] == "SET" && args[1] == "5" && args[2] == "42");
+  request req = resp::make_request(args, keys);
+  CHECK(req.type == request::Type::set && req.num_keys == 1);
+  CHECK(keys[req.first_key] == 5 && req.value == 42);
+  // every prefix is incomplete
+  for (size_t len = 0; len < set.size(); ++len) {
+    CHECK(resp::parse_request(std::string_view(set).substr(0, len), consumed,
+                              args) == parse_result::incomplete);
+  }
+
+  // inline commands, case-insensitive
+  CHECK(resp::parse_request("del  1 2 3\r\nGET", consumed, args) ==
+        parse_result::complete);
+  CHECK(consumed == 12 && args.size() == 4);
+  req = resp::make_request(args, keys);
+  CHECK(req.type == request::Type::del && req.num_keys == 3);
+  CHECK(keys[req.first_key] == 1 && keys[req.first_key + 2] == 3);
+  CHECK(resp::parse_request("ping\n", consumed, args) ==
+        parse_result::complete);
+  CHECK(resp::make_request(args, keys).type == request::Type::ping);
+
+  for (std::string_view bad :
+       {"*x\r\n", "*1\r\n", "*1\r\n#3\r\nGET\r\n",
+        "*1\r\n$513\r\n", "*1\r\n$3\r\nGETX\r\n",
+        "*2000\r\n"}) {
+    parse_result result = resp::parse_request(bad, consumed, args);
+    CHECK(result == (bad == "*1\r\n" ? parse_result::incomplete
+                                      : parse_result::protocol_error));
+  }
+  CHECK(resp::parse_request(std::string(2048, 'a'), consumed, args) ==
+        parse_result::protocol_error);
+
+  // requests that parse but cannot run leave the keys alone
+  size_t num_keys = keys.size();
+  for (std::vector<std::string_view> bad_args :
+       {std::vector<std::string_view>{}, {"GET"}, {"SET", "1"}, {"FLUSHALL"},
+        {"SET", "1", "x"}, {"DEL", "1", "x"}, {"GET", "-1"},
+        {"GET", "18446744073709551615"}}) {
+    req = resp::make_request(bad_args, keys);
+    CHECK(req.type == request::Type::error && req.error != nullptr);
+  }
+  CHECK(keys.size() == num_keys);
+}
+
+}  // namespace
+
+int main() {
+  test_reserved_key();
+  test_concurrent_set_reserved_keys();
+  test_execute_batch();
+  test_find_batched_deref();
+  test_probe_many();
+  test_displacement();
+  test_bucket_pair_search();
+  test_duplicate_inserts();
+  test_move_and_clone();
+  test_parallel_bucket_init();
+  test_shrink_to_fit();
+  test_pool_allocator();
+  test_recommend_capacity();
+  test_concurrent_reserved_key();
+  test_concurrent_pending();
+  test_concurrent_assign();
+  test_write_buffer();
+  test_flat_combining_errors();
+  test_flow_table();
+  test_batched_key_layouts();
+  test_front_cache();
+  test_rebalance();
+  test_adaptive();
+  test_adaptive_limits();
+  test_fixed_table();
+  test_resp_parsing();
+  std::cout << "all checks passed" << std::endl;
+}
@@ -0,0 +1,374 @@
+// Load generator for cuckoo-server. Each thread drives its own connections,
+// keeping `pipeline` requests in flight on each: it sends a window of
+// requests on every connection, then reads all of their replies. Windows
+// are capped at MAX_PIPELINE so that their replies never stop the server
+// from reading while the window is still being sent.
+//
+// Keys are drawn uniformly from [1, keys]; with --load the key range is
+// filled with SETs before the timed phase, so that GETs hit.
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "xorshift.hpp"
+
+namespace {
+
+// cuckoo-server stops reading a connection while more than 1 MiB of its
+// replies are unsent, and no reply to a GET or SET is longer than 27 bytes.
+// A window whose replies could reach that would leave both sides blocked in
+// send().
+constexpr size_t MAX_PIPELINE = 16 * 1024;
+
+struct options {
+  std::string host = "127.0.0.1";
+  std::string port = "6379";
+  std::string unix_path;
+  size_t num_threads = 4;
+  size_t num_connections = 4;  // per thread
+  size_t pipeline = 32;
+  size_t num_requests = 1000000;  // per thread
+  uint64_t num_keys = 1000000;
+  double set_ratio = 0.0;
+  bool load = false;
+};
+
+[[noreturn]] void fail(const std::string& what) {
+  throw std::runtime_error{what + ": " + std::strerror(errno)};
+}
+
+int connect_to(const options& opts) {
+  if (!opts.unix_path.empty()) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      fail("socket");
+    }
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (opts.unix_path.size() >= sizeof(addr.sun_path)) {
+      throw std::invalid_argument("unix socket path too long");
+    }
+    std::strcpy(addr.sun_path, opts.unix_path.c_str());
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      fail("connect");
+    }
+    return fd;
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs;
+  int err = getaddrinfo(opts.host.c_str(), opts.port.c_str(), &hints, &addrs);
+  if (err != 0) {
+    throw std::runtime_error{std::string("getaddrinfo: ") + gai_strerror(err)};
+  }
+  for (addrinfo* a = addrs; a; a = a->ai_next) {
+    int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+      freeaddrinfo(addrs);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      return fd;
+    }
+    close(fd);
+  }
+  freeaddrinfo(addrs);
+  fail("connect");
+}
+
+void append_arg(std::string& out, std::string_view arg) {
+  out += '$';
+  out += std::to_string(arg.size());
+  out += "\r\n";
+  out += arg;
+  out += "\r\n";
+}
+
+void append_get(std::string& out, uint64_t key) {
+  out += "*2\r\n";
+  append_arg(out, "GET");
+  append_arg(out, std::to_string(key));
+}
+
+void append_set(std::string& out, uint64_t key, uint64_t value) {
+  out += "*3\r\n";
+  append_arg(out, "SET");
+  append_arg(out, std::to_string(key));
+  append_arg(out, std::to_string(value));
+}
+
+void send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("send");
+    }
+    data.remove_prefix(n);
+  }
+}
+
+struct reply_stats {
+  size_t hits{0};
+  size_t misses{0};
+  size_t errors{0};
+};
+
+// Reads replies from a connection until `count` of them are complete.
+class reply_reader {
+ public:
+  explicit reply_reader(int fd) : fd_(fd) {}
+
+  void read_replies(size_t count, reply_stats& stats) {
+    while (count > 0) {
+      std::optional<size_t> consumed = parse_one(stats);
+      if (consumed) {
+        pos_ += *consumed;
+        count--;
+        continue;
+      }
+      buf_.erase(0, pos_);
+      pos_ = 0;
+      char chunk[64 * 1024];
+      ssize_t n = read(fd_, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        throw std::runtime_error{"connection closed by server"};
+      }
+      buf_.append(chunk, n);
+    }
+  }
+
+ private:
+  // Returns the length of the reply at `pos_`, if it is complete.
+  std::optional<size_t> parse_one(reply_stats& stats) {
+    std::string_view in = std::string_view(buf_).substr(pos_);
+    size_t eol = in.find("\r\n");
+    if (eol == std::string_view::npos) {
+      return std::nullopt;
+    }
+    switch (in[0]) {
+      case '+':
+      case ':':
+        return eol + 2;
+      case '-':
+        stats.errors++;
+        return eol + 2;
+      case '$': {
+        long len = 0;
+        std::from_chars(in.data() + 1, in.data() + eol, len);
+        if (len < 0) {
+          stats.misses++;
+          return eol + 2;
+        }
+        size_t total = eol + 2 + len + 2;
+        if (in.size() < total) {
+          return std::nullopt;
+        }
+        stats.hits++;
+        return total;
+      }
+      default:
+        throw std::runtime_error{"unexpected reply from server"};
+    }
+  }
+
+  int fd_;
+  std::string buf_;
+  size_t pos_{0};
+};
+
+// Sends `num_requests` requests spread over `fds`, at most `pipeline` at a
+// time on each, and collects their replies.
+template <class MakeRequest>
+reply_stats drive(const std::vector<int>& fds, size_t pipeline,
+                  size_t num_requests, MakeRequest&& make_request) {
+  std::vector<reply_reader> readers;
+  for (int fd : fds) {
+    readers.emplace_back(fd);
+  }
+  std::vector<size_t> in_flight(fds.size());
+  reply_stats stats;
+  std::string out;
+  size_t sent = 0;
+  while (sent < num_requests) {
+    for (size_t c = 0; c < fds.size() && sent < num_requests; ++c) {
+      out.clear();
+      size_t window = std::min(pipeline, num_requests - sent);
+      for (size_t i = 0; i < window; ++i) {
+        make_request(out, sent++);
+      }
+      send_all(fds[c], out);
+      in_flight[c] = window;
+    }
+    for (size_t c = 0; c < fds.size(); ++c) {
+      readers[c].read_replies(in_flight[c], stats);
+      in_flight[c] = 0;
+    }
+  }
+  return stats;
+}
+
+options parse_options(int argc, char** argv) {
+  options opts;
+  auto usage = [] {
+    return std::invalid_argument(
+        "usage: cuckoo-loadgen [--host H] [--port N | --unix PATH] "
+        "[--threads N] [--connections N] [--pipeline N] [--requests N] "
+        "[--keys N] [--set-ratio F] [--load]");
+  };
+  auto number = [&](const char* s) {
+    uint64_t value = 0;
+    auto [end, ec] = std::from_chars(s, s + std::strlen(s), value);
+    if (ec != std::errc() || *end != '\0' || value == 0) {
+      throw usage();
+    }
+    return value;
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--load") {
+      opts.load = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      throw usage();
+    }
+    const char* value = argv[++i];
+    if (arg == "--host") {
+      opts.host = value;
+    } else if (arg == "--port") {
+      opts.port = value;
+    } else if (arg == "--unix") {
+      opts.unix_path = value;
+    } else if (arg == "--threads") {
+      opts.num_threads = number(value);
+    } else if (arg == "--connections") {
+      opts.num_connections = number(value);
+    } else if (arg == "--pipeline") {
+      opts.pipeline = number(value);
+      if (opts.pipeline > MAX_PIPELINE) {
+        throw std::invalid_argument("--pipeline is at most " +
+                                    std::to_string(MAX_PIPELINE));
+      }
+    } else if (arg == "--requests") {
+      opts.num_requests = number(value);
+    } else if (arg == "--keys") {
+      opts.num_keys = number(value);
+    } else if (arg == "--set-ratio") {
+      opts.set_ratio = std::stod(value);
+      if (opts.set_ratio < 0.0 || opts.set_ratio > 1.0) {
+        throw usage();
+      }
+    } else {
+      throw usage();
+    }
+  }
+  return opts;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  try {
+    options opts = parse_options(argc, argv);
+
+    if (opts.load) {
+      std::vector<int> fds;
+      for (size_t i = 0; i < opts.num_connections; ++i) {
+        fds.push_back(connect_to(opts));
+      }
+      reply_stats stats =
+          drive(fds, opts.pipeline, opts.num_keys,
+                [](std::string& out, size_t i) { append_set(out, i + 1, i); });
+      for (int fd : fds) {
+        close(fd);
+      }
+      std::cout << "loaded " << opts.num_keys - stats.errors << " of "
+                << opts.num_keys << " keys" << std::endl;
+    }
+
+    std::vector<reply_stats> stats(opts.num_threads);
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < opts.num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        try {
+          std::vector<int> fds;
+          for (size_t i = 0; i < opts.num_connections; ++i) {
+            fds.push_back(connect_to(opts));
+          }
+          cuckoo::xorshift64 rng(0x9e3779b97f4a7c15 * (t + 1));
+          uint64_t set_threshold =
+              static_cast<uint64_t>(opts.set_ratio * 1024);
+          stats[t] = drive(fds, opts.pipeline, opts.num_requests,
+                           [&](std::string& out, size_t) {
+                             uint64_t key = rng() % opts.num_keys + 1;
+                             if (rng() % 1024 < set_threshold) {
+                               append_set(out, key, key);
+                             } else {
+                               append_get(out, key);
+                             }
+                           });
+          for (int fd : fds) {
+            close(fd);
+          }
+        } catch (const std::exception& e) {
+          std::cerr << e.what() << std::endl;
+          failed = true;
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (failed) {
+      return 1;
+    }
+
+    reply_stats total;
+    for (const reply_stats& s : stats) {
+      total.hits += s.hits;
+      total.misses += s.misses;
+      total.errors += s.errors;
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    size_t num_ops = opts.num_threads * opts.num_requests;
+    size_t num_gets = total.hits + total.misses;
+    std::cout << num_ops << " requests in " << seconds << " s: "
+              << num_ops / seconds / 1e6 << " M ops/s, hit rate "
+              << (num_gets ? 100.0 * total.hits / num_gets : 0.0) << "%, "
+              << total.errors << " errors" << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+// Request parsing for cuckoo-server's subset of the Redis protocol (RESP),
+// kept apart from the socket code so that the unit tests can reach it.
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "cuckoo_table.hpp"
+
+namespace resp {
+
+constexpr size_t MAX_ARGS = 1024;
+// longest argument we accept, more than enough for a 64-bit integer
+constexpr size_t MAX_ARG_LEN = 512;
+
+inline std::optional<uint64_t> parse_u64(std::string_view s) {
+  uint64_t value;
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec != std::errc() || end != s.data() + s.size() || s.empty()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+inline bool iequals(std::string_view a, std::string_view b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](char x, char y) { return (x | 0x20) == (y | 0x20); });
+}
+
+// A parsed request. GET and DEL keys, and SET's key, are taken from a range
+// of the batch's key array.
+struct request {
+  enum class Type : uint8_t { ping, get, set, del, error };
+
+  Type type;
+  size_t first_key{0};
+  size_t num_keys{0};
+  cuckoo::ValueT value{0};
+  const char* error{nullptr};
+};
+
+enum class parse_result { complete, incomplete, protocol_error };
+
+// Parses one request, in RESP array form or as an inline command, from the
+// front of `in`. On success `consumed` is how many bytes it took and `args`
+// point into `in`.
+inline parse_result parse_request(std::string_view in, size_t& consumed,
+                                  std::vector<std::string_view>& args) {
+  args.clear();
+  size_t eol = in.find('\n');
+  if (eol == std::string_view::npos) {
+    return in.size() > MAX_ARG_LEN * 2 ? parse_result::protocol_error
+                                       : parse_result::incomplete;
+  }
+
+  if (in[0] != '*') {
+    // inline command, e.g. from telnet
+    std::string_view line = in.substr(0, eol);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    while (!line.empty()) {
+      size_t begin = line.find_first_not_of(' ');
+      if (begin == std::string_view::npos) {
+        break;
+      }
+      size_t end = std::min(line.find(' ', begin), line.size());
+      args.push_back(line.substr(begin, end - begin));
+      line.remove_prefix(end);
+    }
+    consumed = eol + 1;
+    return parse_result::complete;
+  }
+
+  if (eol < 2 || in[eol - 1] != '\r') {
+    return parse_result::protocol_error;
+  }
+  std::optional<uint64_t> num_args = parse_u64(in.substr(1, eol - 2));
+  if (!num_args || *num_args > MAX_ARGS) {
+    return parse_result::protocol_error;
+  }
+
+  size_t pos = eol + 1;
+  for (uint64_t i = 0; i < *num_args; ++i) {
+    eol = in.find('\n', pos);
+    if (eol == std::string_view::npos) {
+      return in.size() - pos > 32 ? parse_result::protocol_error
+                                  : parse_result::incomplete;
+    }
+    if (in[pos] != '$' || eol - pos < 3 || in[eol - 1] != '\r') {
+      return parse_result::protocol_error;
+    }
+    std::optional<uint64_t> len = parse_u64(in.substr(pos + 1, eol - pos - 2));
+    if (!len || *len > MAX_ARG_LEN) {
+      return parse_result::protocol_error;
+    }
+    pos = eol + 1;
+    if (in.size() < pos + *len + 2) {
+      return parse_result::incomplete;
+    }
+    if (in.substr(pos + *len, 2) != "\r\n") {
+      return parse_result::protocol_error;
+    }
+    args.push_back(in.substr(pos, *len));
+    pos += *len + 2;
+  }
+  consumed = pos;
+  return parse_result::complete;
+}
+
+// Turns parsed arguments into a request, appending its keys to `keys`.
+inline request make_request(const std::vector<std::string_view>& args,
+                            std::vector<cuckoo::KeyT>& keys) {
+  auto error = [](const char* msg) {
+    return request{request::Type::error, 0, 0, 0, msg};
+  };
+  auto add_keys = [&](request req, size_t first_arg, size_t last_arg) {
+    req.first_key = keys.size();
+    for (size_t i = first_arg; i < last_arg; ++i) {
+      std::optional<uint64_t> key = parse_u64(args[i]);
+      if (!key || *key == cuckoo::NULL_KEY) {
+        keys.resize(req.first_key);
+        return error("-ERR value is not an integer or out of range\r\n");
+      }
+      keys.push_back(*key);
+    }
+    req.num_keys = last_arg - first_arg;
+    return req;
+  };
+
+  if (args.empty()) {
+    return error("-ERR empty command\r\n");
+  }
+  std::string_view cmd = args[0];
+  if (iequals(cmd, "PING") && args.size() == 1) {
+    return {request::Type::ping};
+  }
+  if (iequals(cmd, "GET") && args.size() == 2) {
+    return add_keys({request::Type::get}, 1, 2);
+  }
+  if (iequals(cmd, "SET") && args.size() == 3) {
+    std::optional<uint64_t> value = parse_u64(args[2]);
+    if (!value) {
+      return error("-ERR value is not an integer or out of range\r\n");
+    }
+    return add_keys({request::Type::set, 0, 0, *value}, 1, 2);
+  }
+  if (iequals(cmd, "DEL") && args.size() >= 2) {
+    return add_keys({request::Type::del}, 1, args.size());
+  }
+  if (iequals(cmd, "PING") || iequals(cmd, "GET") || iequals(cmd, "SET") ||
+      iequals(cmd, "DEL")) {
+    return error("-ERR wrong number of arguments\r\n");
+  }
+  return error("-ERR unknown command\r\n");
+}
+
+}  // namespace resp
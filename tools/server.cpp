@@ -0,0 +1,527 @@
+// A cache daemon serving a concurrent_cuckoo_table over a subset of the
+// Redis protocol (RESP): PING, GET, SET and DEL, with keys and values that
+// are unsigned 64-bit integers in decimal.
+//
+// Each worker thread runs its own epoll loop and owns the connections it
+// accepts; only the table is shared. Over TCP every worker listens on the
+// port with SO_REUSEPORT, so that the kernel spreads connections over them.
+// A Unix socket has a single listener that every loop waits on with
+// EPOLLEXCLUSIVE.
+//
+// Requests are executed one socket read at a time. Runs of consecutive GETs
+// go through find_batched() and runs of SETs and DELs through
+// write_batched(), in request order, so that pipelining clients get the
+// batched paths. A connection whose replies pile up past MAX_PENDING_OUT is
+// not read from until the client catches up.
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrent_cuckoo_table.hpp"
+#include "hash.hpp"
+#include "resp.hpp"
+
+namespace {
+
+using TableT = cuckoo::concurrent_cuckoo_table<CRCHash<uint64_t>>;
+using write_op = TableT::write_op;
+using resp::parse_result;
+using resp::parse_u64;
+using resp::request;
+
+constexpr size_t READ_SZ = 64 * 1024;
+constexpr size_t MAX_EVENTS = 256;
+// unsent replies past which a connection's requests are left unread
+constexpr size_t MAX_PENDING_OUT = 1024 * 1024;
+// how long a loop that ran out of descriptors waits before accepting again,
+// unless one of its own connections closes first
+constexpr auto ACCEPT_RETRY = std::chrono::milliseconds(100);
+
+struct options {
+  uint16_t port = 6379;
+  std::string unix_path;
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t capacity = 16 * 1024 * 1024;
+};
+
+[[noreturn]] void fail(const std::string& what) {
+  throw std::runtime_error{what + ": " + std::strerror(errno)};
+}
+
+void append_integer(std::string& out, char type, uint64_t value) {
+  char buf[24];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  out += type;
+  out.append(buf, end);
+  out += "\r\n";
+}
+
+void append_bulk(std::string& out, uint64_t value) {
+  char buf[24];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  append_integer(out, '$', end - buf);
+  out.append(buf, end);
+  out += "\r\n";
+}
+
+// Applies write ops in order like write_batched(), except that an insert
+// that finds no room fails on its own and the ops after it still apply.
+// Returns which ops failed.
+std::vector<bool> apply_writes(TableT& table, std::vector<write_op>& ops) {
+  std::vector<bool> failed(ops.size());
+  size_t begin = 0;
+  while (begin < ops.size()) {
+    try {
+      table.write_batched(ops.data() + begin, ops.size() - begin);
+      begin = ops.size();
+    } catch (const std::runtime_error&) {
+      while (ops[begin].applied) {
+        begin++;
+      }
+      failed[begin++] = true;
+    }
+  }
+  return failed;
+}
+
+class event_loop {
+ public:
+  event_loop(TableT& table, int listen_fd)
+      : table_(table), listen_fd_(listen_fd) {
+    epoll_fd_ = epoll_create1(0);
+    if (epoll_fd_ < 0) {
+      fail("epoll_create1");
+    }
+    set_accepting(true);
+  }
+
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+
+  ~event_loop() {
+    for (auto& [fd, conn] : conns_) {
+      close(fd);
+    }
+    close(epoll_fd_);
+  }
+
+  void run() {
+    std::array<epoll_event, MAX_EVENTS> events;
+    while (true) {
+      int timeout = -1;
+      if (!accepting_) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(
+            accept_retry_at_ - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+          set_accepting(true);
+        } else {
+          timeout = static_cast<int>(left.count());
+        }
+      }
+      int n = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, timeout);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        fail("epoll_wait");
+      }
+      for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd_) {
+          accept_all();
+          continue;
+        }
+        auto it = conns_.find(fd);
+        if (it == conns_.end()) {
+          continue;
+        }
+        bool open = true;
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+          open = on_readable(fd, it->second);
+        }
+        if (open && (events[i].events & EPOLLOUT)) {
+          open = flush(fd, it->second);
+        }
+        if (!open) {
+          close_conn(fd);
+        }
+      }
+    }
+  }
+
+ private:
+  struct connection {
+    std::string in;
+    std::string out;
+    bool closing{false};
+    // the events the connection is registered for
+    uint32_t events{EPOLLIN};
+  };
+
+  // The listener is level-triggered, so while the process is out of
+  // descriptors it would report the pending connection on every wait. Stop
+  // polling it until a connection closes or ACCEPT_RETRY passes. An
+  // EPOLLEXCLUSIVE registration cannot be modified, only removed and added.
+  void set_accepting(bool accepting) {
+    if (accepting == accepting_) {
+      return;
+    }
+    if (!accepting) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+      accepting_ = false;
+      return;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = listen_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) {
+      fail("epoll_ctl");
+    }
+    accepting_ = true;
+  }
+
+  void accept_all() {
+    while (true) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        if (errno == EMFILE || errno == ENFILE) {
+          accept_retry_at_ = std::chrono::steady_clock::now() + ACCEPT_RETRY;
+          set_accepting(false);
+        }
+        return;  // EAGAIN, or another loop took it
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        close(fd);
+        continue;
+      }
+      conns_.emplace(fd, connection{});
+    }
+  }
+
+  void close_conn(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns_.erase(fd);
+    set_accepting(true);
+  }
+
+  // Reads once and executes every complete request in the buffer. Returns
+  // false once the connection should be closed. At end of input the
+  // connection closes once flush() has sent the replies still queued.
+  bool on_readable(int fd, connection& conn) {
+    if (conn.closing) {
+      return flush(fd, conn);  // EPOLLHUP while replies drain
+    }
+    size_t old_sz = conn.in.size();
+    conn.in.resize(old_sz + READ_SZ);
+    ssize_t n = read(fd, conn.in.data() + old_sz, READ_SZ);
+    if (n < 0) {
+      conn.in.resize(old_sz);
+      return errno == EAGAIN || errno == EINTR;
+    }
+    if (n == 0) {
+      conn.in.resize(old_sz);
+      conn.closing = true;
+      return flush(fd, conn);
+    }
+    conn.in.resize(old_sz + n);
+
+    size_t consumed = execute(conn);
+    conn.in.erase(0, consumed);
+    return flush(fd, conn);
+  }
+
+  // Sends what it can of the replies. Returns false once the connection
+  // should be closed.
+  bool flush(int fd, connection& conn) {
+    size_t sent = 0;
+    while (sent < conn.out.size()) {
+      ssize_t n = send(fd, conn.out.data() + sent, conn.out.size() - sent,
+                       MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN) {
+          return false;
+        }
+        break;
+      }
+      sent += n;
+    }
+    conn.out.erase(0, sent);
+
+    // stop reading while the client is not taking its replies, or once it
+    // is done sending
+    bool want_write = !conn.out.empty();
+    bool want_read = !conn.closing && conn.out.size() <= MAX_PENDING_OUT;
+    uint32_t events = 0;
+    if (want_read) {
+      events |= EPOLLIN;
+    }
+    if (want_write) {
+      events |= EPOLLOUT;
+    }
+    if (events != conn.events) {
+      epoll_event ev{};
+      ev.events = events;
+      ev.data.fd = fd;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+      conn.events = events;
+    }
+    return want_write || !conn.closing;
+  }
+
+  // Parses and executes the complete requests at the front of `conn.in`,
+  // appending their replies to `conn.out`. Returns how many bytes they took.
+  size_t execute(connection& conn) {
+    std::string_view in = conn.in;
+    size_t pos = 0;
+    requests_.clear();
+    keys_.clear();
+    while (pos < in.size() && !conn.closing) {
+      size_t consumed;
+      switch (resp::parse_request(in.substr(pos), consumed, args_)) {
+        case parse_result::complete:
+          pos += consumed;
+          requests_.push_back(resp::make_request(args_, keys_));
+          break;
+        case parse_result::incomplete:
+          goto done;
+        case parse_result::protocol_error:
+          requests_.push_back({request::Type::error, 0, 0, 0,
+                               "-ERR Protocol error\r\n"});
+          conn.closing = true;
+          pos = in.size();
+          break;
+      }
+    }
+  done:
+    for (size_t begin = 0; begin < requests_.size();) {
+      size_t end = begin + 1;
+      request::Type type = requests_[begin].type;
+      if (type == request::Type::get) {
+        while (end < requests_.size() &&
+               requests_[end].type == request::Type::get) {
+          end++;
+        }
+        execute_gets(begin, end, conn.out);
+      } else if (type == request::Type::set || type == request::Type::del) {
+        while (end < requests_.size() &&
+               (requests_[end].type == request::Type::set ||
+                requests_[end].type == request::Type::del)) {
+          end++;
+        }
+        execute_writes(begin, end, conn.out);
+      } else if (type == request::Type::ping) {
+        conn.out += "+PONG\r\n";
+      } else {
+        conn.out += requests_[begin].error;
+      }
+      begin = end;
+    }
+    return pos;
+  }
+
+  void execute_gets(size_t begin, size_t end, std::string& out) {
+    size_t first_key = requests_[begin].first_key;
+    size_t num_keys = end - begin;
+    values_.resize(num_keys);
+    table_.find_batched(keys_.data() + first_key, num_keys, values_.data());
+    for (const std::optional<cuckoo::ValueT>& value : values_) {
+      if (value) {
+        append_bulk(out, *value);
+      } else {
+        out += "$-1\r\n";
+      }
+    }
+  }
+
+  // A SET is one assign of the key, a DEL one erase per key.
+  void execute_writes(size_t begin, size_t end, std::string& out) {
+    ops_.clear();
+    for (size_t i = begin; i < end; ++i) {
+      const request& req = requests_[i];
+      if (req.type == request::Type::set) {
+        ops_.push_back(
+            {write_op::Type::assign, keys_[req.first_key], req.value});
+        continue;
+      }
+      for (size_t k = 0; k < req.num_keys; ++k) {
+        ops_.push_back({write_op::Type::erase, keys_[req.first_key + k]});
+      }
+    }
+
+    std::vector<bool> failed = apply_writes(table_, ops_);
+    size_t op_idx = 0;
+    for (size_t i = begin; i < end; ++i) {
+      const request& req = requests_[i];
+      if (req.type == request::Type::set) {
+        out += failed[op_idx++] ? "-ERR table full\r\n" : "+OK\r\n";
+        continue;
+      }
+      uint64_t num_deleted = 0;
+      for (size_t k = 0; k < req.num_keys; ++k) {
+        num_deleted += ops_[op_idx++].found;
+      }
+      append_integer(out, ':', num_deleted);
+    }
+  }
+
+  TableT& table_;
+  int listen_fd_;
+  int epoll_fd_;
+  bool accepting_{false};
+  std::chrono::steady_clock::time_point accept_retry_at_;
+  std::unordered_map<int, connection> conns_;
+
+  // scratch space reused across reads
+  std::vector<std::string_view> args_;
+  std::vector<request> requests_;
+  std::vector<cuckoo::KeyT> keys_;
+  std::vector<std::optional<cuckoo::ValueT>> values_;
+  std::vector<write_op> ops_;
+};
+
+int listen_tcp(uint16_t port) {
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    fail("socket");
+  }
+  int one = 1;
+  int zero = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+    fail("SO_REUSEPORT");
+  }
+  sockaddr_in6 addr{};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    fail("bind");
+  }
+  if (listen(fd, SOMAXCONN) != 0) {
+    fail("listen");
+  }
+  return fd;
+}
+
+int listen_unix(const std::string& path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    fail("socket");
+  }
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::invalid_argument("unix socket path too long");
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    fail("bind");
+  }
+  if (listen(fd, SOMAXCONN) != 0) {
+    fail("listen");
+  }
+  return fd;
+}
+
+options parse_options(int argc, char** argv) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    std::optional<uint64_t> value =
+        i + 1 < argc ? parse_u64(argv[i + 1]) : std::nullopt;
+    if (arg == "--unix" && i + 1 < argc) {
+      opts.unix_path = argv[++i];
+    } else if (arg == "--port" && value && *value <= 65535) {
+      opts.port = static_cast<uint16_t>(*value);
+      ++i;
+    } else if (arg == "--threads" && value && *value > 0) {
+      opts.num_threads = *value;
+      ++i;
+    } else if (arg == "--capacity" && value && *value > 0) {
+      opts.capacity = *value;
+      ++i;
+    } else {
+      throw std::invalid_argument(
+          "usage: cuckoo-server [--port N | --unix PATH] [--threads N] "
+          "[--capacity N]");
+    }
+  }
+  return opts;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  try {
+    options opts = parse_options(argc, argv);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    TableT table(opts.capacity);
+    std::vector<int> listen_fds;
+    if (!opts.unix_path.empty()) {
+      listen_fds.push_back(listen_unix(opts.unix_path));
+    } else {
+      for (size_t i = 0; i < opts.num_threads; ++i) {
+        listen_fds.push_back(listen_tcp(opts.port));
+      }
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < opts.num_threads; ++i) {
+      int fd = listen_fds[i % listen_fds.size()];
+      workers.emplace_back([&table, fd] {
+        try {
+          event_loop(table, fd).run();
+        } catch (const std::exception& e) {
+          std::cerr << e.what() << std::endl;
+          std::exit(1);
+        }
+      });
+    }
+    std::cerr << "serving " << (opts.unix_path.empty() ? "port " : "")
+              << (opts.unix_path.empty() ? std::to_string(opts.port)
+                                         : opts.unix_path)
+              << " on " << opts.num_threads << " thread(s)" << std::endl;
+    for (auto& t : workers) {
+      t.join();
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}